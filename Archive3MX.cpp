@@ -0,0 +1,316 @@
+#include "Archive3MX.h"
+
+#include <osg/Notify>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
+
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Archive3MX::Archive3MX() :
+	_fileSize(0),
+	_mapping(nullptr)
+#ifdef _WIN32
+	, _mappingHandle(nullptr)
+#endif
+{
+}
+
+Archive3MX::~Archive3MX()
+{
+	close();
+}
+
+bool Archive3MX::acceptsExtension(const std::string& extension) const
+{
+	return osgDB::equalCaseInsensitive(extension, "3mxa");
+}
+
+bool Archive3MX::open(const std::string& fileName, bool useMmap)
+{
+	close();
+
+	_file.open(fileName.c_str(), std::ios::in | std::ios::binary);
+	if (!_file)
+	{
+		OSG_FATAL << "Reading archive " << fileName << " failed! Can NOT open file." << std::endl;
+		return false;
+	}
+	_file.seekg(0, std::ios::end);
+	_fileSize = (uint64_t)_file.tellg();
+	_file.seekg(0, std::ios::beg);
+
+	// header
+	char magic[4];
+	uint32_t fileVersion = 0, entryCount = 0;
+	_file.read(magic, 4);
+	_file.read((char*)&fileVersion, 4);
+	_file.read((char*)&entryCount, 4);
+	if (!_file || memcmp(magic, magicNumber(), 4) != 0 || fileVersion != version)
+	{
+		OSG_FATAL << "Reading archive " << fileName << " failed! Invalid header." << std::endl;
+		close();
+		return false;
+	}
+
+	// index
+	_index.reserve(entryCount);
+	for (uint32_t i = 0; i < entryCount; ++i)
+	{
+		uint16_t nameLength = 0;
+		_file.read((char*)&nameLength, 2);
+		std::string name(nameLength, '\0');
+		IndexEntry entry;
+		if (nameLength) _file.read(&name[0], nameLength);
+		_file.read((char*)&entry.offset, 8);
+		_file.read((char*)&entry.size, 8);
+		if (!_file || entry.offset > _fileSize || entry.size > _fileSize - entry.offset)
+		{
+			OSG_FATAL << "Reading archive " << fileName << " failed! Invalid index." << std::endl;
+			close();
+			return false;
+		}
+		name = normalizeEntryName(name);
+		if (i == 0) _masterFileName = name;
+		_index[name] = entry;
+	}
+	_archiveFileName = fileName;
+
+	if (useMmap && _fileSize && _fileSize == (uint64_t)(size_t)_fileSize)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			_mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (_mappingHandle)
+			{
+				_mapping = (const char*)MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+				if (!_mapping)
+				{
+					CloseHandle(_mappingHandle);
+					_mappingHandle = nullptr;
+				}
+			}
+			CloseHandle(file);
+		}
+#else
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			void* mapping = mmap(nullptr, (size_t)_fileSize, PROT_READ, MAP_SHARED, fd, 0);
+			if (mapping != MAP_FAILED) _mapping = (const char*)mapping;
+			::close(fd);
+		}
+#endif
+		if (_mapping)
+		{
+			_file.close();
+		}
+		else
+		{
+			OSG_INFO << "Mapping archive " << fileName << " failed, reading entries from the file." << std::endl;
+		}
+	}
+	return true;
+}
+
+void Archive3MX::close()
+{
+	if (_mapping)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(_mapping);
+		CloseHandle(_mappingHandle);
+		_mappingHandle = nullptr;
+#else
+		munmap((void*)_mapping, (size_t)_fileSize);
+#endif
+		_mapping = nullptr;
+	}
+	if (_file.is_open()) _file.close();
+	_index.clear();
+	_fileSize = 0;
+}
+
+bool Archive3MX::readEntry(const std::string& name, Entry& entry) const
+{
+	auto itr = _index.find(name);
+	if (itr == _index.end())
+	{
+		itr = _index.find(normalizeEntryName(name));
+		if (itr == _index.end()) return false;
+	}
+
+	entry.size = (size_t)itr->second.size;
+	if (_mapping)
+	{
+		entry.data = _mapping + itr->second.offset;
+		return true;
+	}
+
+	entry.buffer.resize(entry.size);
+	{
+		std::lock_guard<std::mutex> lock(_fileMutex);
+		if (!_file.is_open()) return false;
+		_file.clear();
+		_file.seekg((std::streamoff)itr->second.offset, std::ios::beg);
+		if (entry.size) _file.read(&entry.buffer[0], entry.size);
+		if ((size_t)_file.gcount() != entry.size) return false;
+	}
+	entry.data = entry.buffer.empty() ? nullptr : &entry.buffer[0];
+	return true;
+}
+
+std::string Archive3MX::normalizeEntryName(const std::string& name)
+{
+	std::vector<std::string> components;
+	std::string::size_type start = 0;
+	while (start <= name.size())
+	{
+		std::string::size_type end = name.find_first_of("/\\", start);
+		if (end == std::string::npos) end = name.size();
+		std::string component = name.substr(start, end - start);
+		if (component == "..")
+		{
+			if (!components.empty()) components.pop_back();
+		}
+		else if (!component.empty() && component != ".")
+		{
+			components.push_back(component);
+		}
+		start = end + 1;
+	}
+
+	std::string result;
+	for (auto& component : components)
+	{
+		if (!result.empty()) result += '/';
+		result += component;
+	}
+	return result;
+}
+
+bool Archive3MX::write(const std::string& fileName, const std::string& baseDir, const std::vector<std::string>& entryNames)
+{
+	// sizes of the entries, to lay out the index
+	std::vector<uint64_t> sizes;
+	uint64_t offset = 12;
+	for (auto& name : entryNames)
+	{
+		if (name.size() > 0xFFFF)
+		{
+			OSG_FATAL << "Writing archive " << fileName << " failed! Entry name too long: " << name << std::endl;
+			return false;
+		}
+		std::ifstream inFile(osgDB::concatPaths(baseDir, name), std::ios::in | std::ios::binary | std::ios::ate);
+		if (!inFile)
+		{
+			OSG_FATAL << "Writing archive " << fileName << " failed! Can NOT open file " << osgDB::concatPaths(baseDir, name) << std::endl;
+			return false;
+		}
+		sizes.push_back((uint64_t)inFile.tellg());
+		offset += 2 + name.size() + 16;
+	}
+
+	std::ofstream outFile(fileName, std::ios::out | std::ios::binary);
+	uint32_t fileVersion = version;
+	uint32_t entryCount = (uint32_t)entryNames.size();
+	outFile.write(magicNumber(), 4);
+	outFile.write((const char*)&fileVersion, 4);
+	outFile.write((const char*)&entryCount, 4);
+	for (size_t i = 0; i < entryNames.size(); ++i)
+	{
+		uint16_t nameLength = (uint16_t)entryNames[i].size();
+		outFile.write((const char*)&nameLength, 2);
+		outFile.write(entryNames[i].data(), nameLength);
+		outFile.write((const char*)&offset, 8);
+		outFile.write((const char*)&sizes[i], 8);
+		offset += sizes[i];
+	}
+
+	std::vector<char> buffer;
+	for (size_t i = 0; i < entryNames.size(); ++i)
+	{
+		std::ifstream inFile(osgDB::concatPaths(baseDir, entryNames[i]), std::ios::in | std::ios::binary);
+		buffer.resize((size_t)sizes[i]);
+		if (!buffer.empty()) inFile.read(&buffer[0], buffer.size());
+		if ((size_t)inFile.gcount() != buffer.size())
+		{
+			OSG_FATAL << "Writing archive " << fileName << " failed! Can NOT read file " << osgDB::concatPaths(baseDir, entryNames[i]) << std::endl;
+			return false;
+		}
+		outFile.write(buffer.data(), buffer.size());
+	}
+
+	if (!outFile)
+	{
+		OSG_FATAL << "Writing archive " << fileName << " failed!" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool Archive3MX::splitPath(const std::string& path, std::string& archiveName, std::string& entryName)
+{
+	std::string lowerPath = osgDB::convertToLowerCase(path);
+	std::string::size_type pos = lowerPath.find(".3mxa/");
+	if (pos == std::string::npos) pos = lowerPath.find(".3mxa\\");
+	if (pos == std::string::npos) return false;
+
+	pos += 5; // ".3mxa"
+	archiveName = path.substr(0, pos);
+	entryName = normalizeEntryName(path.substr(pos + 1));
+	return !entryName.empty();
+}
+
+bool Archive3MX::fileExists(const std::string& filename) const
+{
+	return _index.find(normalizeEntryName(filename)) != _index.end();
+}
+
+osgDB::FileType Archive3MX::getFileType(const std::string& filename) const
+{
+	std::string name = normalizeEntryName(filename);
+	if (_index.find(name) != _index.end()) return osgDB::REGULAR_FILE;
+
+	std::string prefix = name + "/";
+	for (auto& entry : _index)
+	{
+		if (entry.first.compare(0, prefix.size(), prefix) == 0) return osgDB::DIRECTORY;
+	}
+	return osgDB::FILE_NOT_FOUND;
+}
+
+bool Archive3MX::getFileNames(FileNameList& fileNames) const
+{
+	for (auto& entry : _index)
+	{
+		fileNames.push_back(entry.first);
+	}
+	std::sort(fileNames.begin(), fileNames.end());
+	return !_index.empty();
+}
+
+osgDB::ReaderWriter::ReadResult Archive3MX::readObject(const std::string& fileName, const osgDB::Options* options) const
+{
+	return readNode(fileName, options);
+}
+
+osgDB::ReaderWriter::ReadResult Archive3MX::readNode(const std::string& fileName, const osgDB::Options* options) const
+{
+	osgDB::ReaderWriter* reader = osgDB::Registry::instance()->getReaderWriterForExtension("3mx");
+	if (!reader) return ReadResult::FILE_NOT_HANDLED;
+	return reader->readNode(_archiveFileName + "/" + normalizeEntryName(fileName), options);
+}
@@ -0,0 +1,107 @@
+#ifndef ARCHIVE_3MX_H
+#define ARCHIVE_3MX_H
+
+#include <osgDB/Archive>
+#include <osgDB/fstream>
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Packed 3mx dataset (.3mxa): a single file holding a .3mx root and all its
+// .3mxb tiles, indexed by their paths relative to the .3mx. Paths inside the
+// archive, e.g. "dataset.3mxa/Data/Tile_0/Tile_0.3mxb", are resolved by the
+// 3mx reader itself, so opening a tile is a table lookup instead of a file
+// system search. Layout, little endian:
+//     "3MXA"                                  magic number
+//     uint32 version                          1
+//     uint32 entry count
+//     entry count x (uint16 name length, name, uint64 offset, uint64 size)
+//     entry data, at offsets from the file start
+// The first entry is the .3mx root.
+class Archive3MX : public osgDB::Archive
+{
+public:
+	static const char* magicNumber() { return "3MXA"; }
+	static const uint32_t version = 1;
+
+	// Data of an entry: a view into the file mapping, or a copy of it when
+	// the file is not mapped.
+	struct Entry
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+		std::vector<char> buffer;
+	};
+
+	Archive3MX();
+
+	// Opens an archive, mapping it into memory unless useMmap is false or the
+	// mapping fails.
+	bool open(const std::string& fileName, bool useMmap);
+	bool readEntry(const std::string& name, Entry& entry) const;
+
+	// Splits "dir/dataset.3mxa/Data/tile.3mxb" into the archive file name and
+	// the normalized entry name.
+	static bool splitPath(const std::string& path, std::string& archiveName, std::string& entryName);
+
+	// Converts to forward slashes and removes "." and ".." components.
+	static std::string normalizeEntryName(const std::string& name);
+
+	// Packs the files baseDir/entryNames[i] into a new archive, in this order.
+	// The first entry should be the .3mx root.
+	static bool write(const std::string& fileName, const std::string& baseDir, const std::vector<std::string>& entryNames);
+
+	virtual const char* libraryName() const { return "osgdb_3mx"; }
+	virtual const char* className() const { return "3mxa archive"; }
+	virtual bool acceptsExtension(const std::string& extension) const;
+
+	virtual void close();
+	virtual bool fileExists(const std::string& filename) const;
+	virtual osgDB::FileType getFileType(const std::string& filename) const;
+	virtual bool getFileNames(FileNameList& fileNames) const;
+	virtual std::string getArchiveFileName() const { return _archiveFileName; }
+	virtual std::string getMasterFileName() const { return _masterFileName; }
+
+	// Tiles are read through the 3mx reader, which resolves archive paths.
+	virtual ReadResult readObject(const std::string& fileName, const osgDB::Options* options = NULL) const;
+	virtual ReadResult readImage(const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return ReadResult::FILE_NOT_HANDLED; }
+	virtual ReadResult readHeightField(const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return ReadResult::FILE_NOT_HANDLED; }
+	virtual ReadResult readNode(const std::string& fileName, const osgDB::Options* options = NULL) const;
+	virtual ReadResult readShader(const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return ReadResult::FILE_NOT_HANDLED; }
+
+	virtual WriteResult writeObject(const osg::Object& /*obj*/, const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return WriteResult::FILE_NOT_HANDLED; }
+	virtual WriteResult writeImage(const osg::Image& /*image*/, const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return WriteResult::FILE_NOT_HANDLED; }
+	virtual WriteResult writeHeightField(const osg::HeightField& /*heightField*/, const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return WriteResult::FILE_NOT_HANDLED; }
+	virtual WriteResult writeNode(const osg::Node& /*node*/, const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return WriteResult::FILE_NOT_HANDLED; }
+	virtual WriteResult writeShader(const osg::Shader& /*shader*/, const std::string& /*fileName*/, const osgDB::Options* = NULL) const { return WriteResult::FILE_NOT_HANDLED; }
+
+protected:
+	virtual ~Archive3MX();
+
+private:
+	struct IndexEntry
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	std::string _archiveFileName;
+	std::string _masterFileName;
+	std::unordered_map<std::string, IndexEntry> _index;
+	uint64_t _fileSize;
+
+	// memory mapping of the whole file, if any
+	const char* _mapping;
+#ifdef _WIN32
+	void* _mappingHandle;
+#endif
+
+	// otherwise entries are read from the file
+	mutable std::mutex _fileMutex;
+	mutable osgDB::ifstream _file;
+};
+
+#endif // ARCHIVE_3MX_H
@@ -0,0 +1,132 @@
+#include "Ktx3MX.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+	const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const uint32_t endianness = 0x04030201;
+
+	// header fields following the identifier
+	enum Field
+	{
+		FIELD_ENDIANNESS, FIELD_TYPE, FIELD_TYPE_SIZE, FIELD_FORMAT, FIELD_INTERNAL_FORMAT, FIELD_BASE_INTERNAL_FORMAT,
+		FIELD_WIDTH, FIELD_HEIGHT, FIELD_DEPTH, FIELD_ARRAY_ELEMENTS, FIELD_FACES,
+		FIELD_MIPMAP_LEVELS, FIELD_KEY_VALUE_BYTES, NUM_FIELDS
+	};
+
+	uint32_t levelSize(uint32_t internalFormat, uint32_t width, uint32_t height)
+	{
+		return ((width + 3) / 4) * ((height + 3) / 4) * Ktx3MX::blockSize(internalFormat);
+	}
+
+	uint32_t baseInternalFormat(uint32_t internalFormat)
+	{
+		switch (internalFormat)
+		{
+		case 0x83F0: case 0x8D64: case 0x9274: case 0x9275: return 0x1907; // GL_RGB
+		default: return 0x1908; // GL_RGBA
+		}
+	}
+}
+
+unsigned int Ktx3MX::blockSize(uint32_t internalFormat)
+{
+	switch (internalFormat)
+	{
+	case 0x83F0: // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	case 0x83F1: // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+	case 0x8D64: // GL_ETC1_RGB8_OES
+	case 0x9274: // GL_COMPRESSED_RGB8_ETC2
+	case 0x9275: // GL_COMPRESSED_SRGB8_ETC2
+		return 8;
+	case 0x83F2: // GL_COMPRESSED_RGBA_S3TC_DXT3_EXT
+	case 0x83F3: // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	case 0x8E8C: // GL_COMPRESSED_RGBA_BPTC_UNORM
+	case 0x8E8D: // GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+	case 0x9278: // GL_COMPRESSED_RGBA8_ETC2_EAC
+	case 0x9279: // GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+osg::ref_ptr<osg::Image> Ktx3MX::readImage(const char* data, size_t size)
+{
+	uint32_t fields[NUM_FIELDS];
+	if (size < sizeof(identifier) + sizeof(fields) || memcmp(data, identifier, sizeof(identifier)) != 0) return nullptr;
+	memcpy(fields, data + sizeof(identifier), sizeof(fields));
+
+	// a single 2D texture, in a compressed format of the platform endianness
+	uint32_t internalFormat = fields[FIELD_INTERNAL_FORMAT];
+	uint32_t width = fields[FIELD_WIDTH];
+	uint32_t height = fields[FIELD_HEIGHT];
+	uint32_t numLevels = std::max(fields[FIELD_MIPMAP_LEVELS], 1u);
+	if (fields[FIELD_ENDIANNESS] != endianness || fields[FIELD_TYPE] != 0 || fields[FIELD_FORMAT] != 0 || !blockSize(internalFormat)
+		|| width == 0 || height == 0 || width > 16384 || height > 16384 || fields[FIELD_DEPTH] > 1
+		|| fields[FIELD_ARRAY_ELEMENTS] > 1 || fields[FIELD_FACES] != 1 || numLevels > 15)
+	{
+		return nullptr;
+	}
+
+	size_t pos = sizeof(identifier) + sizeof(fields);
+	if (size - pos < fields[FIELD_KEY_VALUE_BYTES]) return nullptr;
+	pos += fields[FIELD_KEY_VALUE_BYTES];
+
+	// the levels are contiguous in the image, with their offsets as mipmap levels
+	uint32_t totalSize = 0;
+	osg::Image::MipmapDataType offsets;
+	for (uint32_t level = 0, w = width, h = height; level < numLevels; ++level, w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+	{
+		if (level) offsets.push_back(totalSize);
+		totalSize += levelSize(internalFormat, w, h);
+	}
+	if (size - pos < totalSize) return nullptr;
+
+	unsigned char* imageData = new unsigned char[totalSize];
+	for (uint32_t level = 0, w = width, h = height; level < numLevels; ++level, w = std::max(w / 2, 1u), h = std::max(h / 2, 1u))
+	{
+		uint32_t imageSize = 0;
+		if (size - pos < 4) break;
+		memcpy(&imageSize, data + pos, 4);
+		pos += 4;
+		if (imageSize != levelSize(internalFormat, w, h) || size - pos < imageSize) break;
+
+		memcpy(imageData + (level ? offsets[level - 1] : 0), data + pos, imageSize);
+		pos += (imageSize + 3) & ~3u;
+		if (level + 1 == numLevels)
+		{
+			osg::ref_ptr<osg::Image> image = new osg::Image;
+			image->setImage(width, height, 1, internalFormat, internalFormat, GL_UNSIGNED_BYTE, imageData, osg::Image::USE_NEW_DELETE);
+			if (!offsets.empty()) image->setMipmapLevels(offsets);
+			return image;
+		}
+	}
+	delete[] imageData;
+	return nullptr;
+}
+
+void Ktx3MX::write(uint32_t internalFormat, uint32_t width, uint32_t height, const std::vector<std::string>& levels, std::string& buffer)
+{
+	uint32_t fields[NUM_FIELDS] = { 0 };
+	fields[FIELD_ENDIANNESS] = endianness;
+	fields[FIELD_TYPE_SIZE] = 1;
+	fields[FIELD_INTERNAL_FORMAT] = internalFormat;
+	fields[FIELD_BASE_INTERNAL_FORMAT] = baseInternalFormat(internalFormat);
+	fields[FIELD_WIDTH] = width;
+	fields[FIELD_HEIGHT] = height;
+	fields[FIELD_FACES] = 1;
+	fields[FIELD_MIPMAP_LEVELS] = (uint32_t)levels.size();
+
+	buffer.append((const char*)identifier, sizeof(identifier));
+	buffer.append((const char*)fields, sizeof(fields));
+	for (auto& level : levels)
+	{
+		uint32_t imageSize = (uint32_t)level.size();
+		buffer.append((const char*)&imageSize, 4);
+		buffer.append(level);
+		buffer.append((4 - imageSize % 4) % 4, '\0');
+	}
+}
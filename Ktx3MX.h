@@ -0,0 +1,31 @@
+#ifndef KTX_3MX_H
+#define KTX_3MX_H
+
+#include <osg/Image>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// GPU compressed textures of the "ktx" textureBuffer format: KTX 1.1 files of
+// a 2D texture in a block compressed format (BC1-3 and BC7, or ETC1/ETC2),
+// with or without stored mipmaps. They are copied into an osg::Image without
+// any decoding. As KTX specifies for OpenGL, the first row of a level is at
+// t = 0, like the rows of the osg::Images decoded from the jpg textures.
+class Ktx3MX
+{
+public:
+	// Bytes of a 4x4 block of a supported internal format, 0 if not supported.
+	static unsigned int blockSize(uint32_t internalFormat);
+
+	// Reads the KTX file data[0, size) into a compressed image holding all its
+	// levels, or returns null if it is invalid or not supported.
+	static osg::ref_ptr<osg::Image> readImage(const char* data, size_t size);
+
+	// Appends a KTX file of a width x height texture in internalFormat, whose
+	// mipmap levels, from the full size down, are already compressed.
+	static void write(uint32_t internalFormat, uint32_t width, uint32_t height, const std::vector<std::string>& levels, std::string& buffer);
+};
+
+#endif // KTX_3MX_H
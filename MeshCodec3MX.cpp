@@ -0,0 +1,251 @@
+#include "MeshCodec3MX.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	const uint32_t blockSize = 256;
+	const uint32_t groupSize = 16;
+	const size_t headerSize = 20;
+
+	inline unsigned char zigzag8(unsigned char d) { return (unsigned char)((d << 1) ^ (unsigned char)((signed char)d >> 7)); }
+	inline unsigned char unzigzag8(unsigned char z) { return (unsigned char)((z >> 1) ^ (unsigned char)-(z & 1)); }
+	inline uint32_t zigzag32(uint32_t d) { return (d << 1) ^ (uint32_t)((int32_t)d >> 31); }
+	inline uint32_t unzigzag32(uint32_t z) { return (z >> 1) ^ (uint32_t)-(int32_t)(z & 1); }
+
+	void appendUInt(std::string& buffer, uint32_t value)
+	{
+		buffer.append((const char*)&value, 4);
+	}
+
+	// Appends the group headers and data of a channel of n values, n a
+	// multiple of groupSize.
+	void encodeChannel(const unsigned char* z, uint32_t n, std::string& buffer)
+	{
+		uint32_t groups = n / groupSize;
+		size_t headerPos = buffer.size();
+		buffer.append((groups + 3) / 4, '\0');
+		for (uint32_t g = 0; g < groups; ++g)
+		{
+			const unsigned char* values = z + g * groupSize;
+			unsigned char maxValue = 0;
+			for (uint32_t i = 0; i < groupSize; ++i) maxValue |= values[i];
+
+			unsigned int mode = maxValue == 0 ? 0 : maxValue < 4 ? 1 : maxValue < 16 ? 2 : 3;
+			buffer[headerPos + g / 4] |= (char)(mode << ((g % 4) * 2));
+			if (mode == 1)
+			{
+				for (uint32_t i = 0; i < groupSize; i += 4)
+				{
+					buffer += (char)(values[i] | (values[i + 1] << 2) | (values[i + 2] << 4) | (values[i + 3] << 6));
+				}
+			}
+			else if (mode == 2)
+			{
+				for (uint32_t i = 0; i < groupSize; i += 2)
+				{
+					buffer += (char)(values[i] | (values[i + 1] << 4));
+				}
+			}
+			else if (mode == 3)
+			{
+				buffer.append((const char*)values, groupSize);
+			}
+		}
+	}
+
+	// Reads a channel of n values from data[pos, end), returns the position
+	// after it, or null if it is truncated.
+	const unsigned char* decodeChannel(const unsigned char* data, const unsigned char* end, unsigned char* z, uint32_t n)
+	{
+		uint32_t groups = n / groupSize;
+		const unsigned char* header = data;
+		data += (groups + 3) / 4;
+		if (data > end) return nullptr;
+
+		for (uint32_t g = 0; g < groups; ++g, z += groupSize)
+		{
+			unsigned int mode = (header[g / 4] >> ((g % 4) * 2)) & 3;
+			static const unsigned char dataSizes[4] = { 0, 4, 8, 16 };
+			if ((size_t)(end - data) < dataSizes[mode]) return nullptr;
+			switch (mode)
+			{
+			case 0:
+				memset(z, 0, groupSize);
+				break;
+			case 1:
+				for (uint32_t i = 0; i < groupSize; i += 4, ++data)
+				{
+					unsigned char b = *data;
+					z[i] = b & 3;
+					z[i + 1] = (b >> 2) & 3;
+					z[i + 2] = (b >> 4) & 3;
+					z[i + 3] = b >> 6;
+				}
+				break;
+			case 2:
+				for (uint32_t i = 0; i < groupSize; i += 2, ++data)
+				{
+					unsigned char b = *data;
+					z[i] = b & 15;
+					z[i + 1] = b >> 4;
+				}
+				break;
+			default:
+				memcpy(z, data, groupSize);
+				data += groupSize;
+			}
+		}
+		return data;
+	}
+
+	// Appends a stream of count elements of stride bytes. With byteDelta, every
+	// byte is coded as the delta from the same byte of the previous element.
+	void encodeStream(const unsigned char* data, uint32_t count, uint32_t stride, bool byteDelta, std::string& buffer)
+	{
+		size_t sizePos = buffer.size();
+		appendUInt(buffer, 0);
+
+		std::vector<unsigned char> prev(stride, 0);
+		unsigned char z[blockSize];
+		for (uint32_t start = 0; start < count; start += blockSize)
+		{
+			uint32_t blockCount = std::min(blockSize, count - start);
+			uint32_t n = (blockCount + groupSize - 1) & ~(groupSize - 1);
+			for (uint32_t k = 0; k < stride; ++k)
+			{
+				const unsigned char* src = data + (size_t)start * stride + k;
+				for (uint32_t i = 0; i < blockCount; ++i, src += stride)
+				{
+					z[i] = byteDelta ? zigzag8((unsigned char)(*src - prev[k])) : *src;
+					prev[k] = *src;
+				}
+				memset(z + blockCount, 0, n - blockCount);
+				encodeChannel(z, n, buffer);
+			}
+		}
+
+		uint32_t streamSize = (uint32_t)(buffer.size() - sizePos - 4);
+		memcpy(&buffer[sizePos], &streamSize, 4);
+	}
+
+	// Decodes a stream of count elements of stride bytes (at most 16) from
+	// data[pos, end) into out, returns the position after it, or null.
+	const unsigned char* decodeStream(const unsigned char* data, const unsigned char* end, unsigned char* out, uint32_t count, uint32_t stride, bool byteDelta)
+	{
+		uint32_t streamSize = 0;
+		if (end - data < 4) return nullptr;
+		memcpy(&streamSize, data, 4);
+		data += 4;
+		if ((size_t)(end - data) < streamSize) return nullptr;
+		end = data + streamSize;
+
+		unsigned char prev[16] = { 0 };
+		unsigned char z[16][blockSize];
+		for (uint32_t start = 0; start < count; start += blockSize)
+		{
+			uint32_t blockCount = std::min(blockSize, count - start);
+			uint32_t n = (blockCount + groupSize - 1) & ~(groupSize - 1);
+			for (uint32_t k = 0; k < stride; ++k)
+			{
+				data = decodeChannel(data, end, z[k], n);
+				if (!data) return nullptr;
+			}
+
+			unsigned char* dst = out + (size_t)start * stride;
+			if (byteDelta)
+			{
+				for (uint32_t i = 0; i < blockCount; ++i)
+				{
+					for (uint32_t k = 0; k < stride; ++k)
+					{
+						prev[k] += unzigzag8(z[k][i]);
+						*dst++ = prev[k];
+					}
+				}
+			}
+			else
+			{
+				for (uint32_t i = 0; i < blockCount; ++i)
+				{
+					for (uint32_t k = 0; k < stride; ++k)
+					{
+						*dst++ = z[k][i];
+					}
+				}
+			}
+		}
+		return data == end ? data : nullptr;
+	}
+}
+
+void MeshCodec3MX::encode(const float* vertices, const float* normals, const float* uvs, uint32_t vertexCount,
+	const uint32_t* indices, uint32_t indexCount, std::string& buffer)
+{
+	uint32_t flags = (normals ? HAS_NORMALS : 0) | (uvs ? HAS_UVS : 0);
+	buffer.append(magicNumber(), 4);
+	appendUInt(buffer, version);
+	appendUInt(buffer, vertexCount);
+	appendUInt(buffer, indexCount);
+	appendUInt(buffer, flags);
+
+	encodeStream((const unsigned char*)vertices, vertexCount, 12, true, buffer);
+	if (normals) encodeStream((const unsigned char*)normals, vertexCount, 12, true, buffer);
+	if (uvs) encodeStream((const unsigned char*)uvs, vertexCount, 8, true, buffer);
+
+	std::vector<uint32_t> deltas(indexCount);
+	uint32_t prevFirst = 0;
+	for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		deltas[i] = zigzag32(indices[i] - prevFirst);
+		deltas[i + 1] = zigzag32(indices[i + 1] - indices[i]);
+		deltas[i + 2] = zigzag32(indices[i + 2] - indices[i]);
+		prevFirst = indices[i];
+	}
+	encodeStream((const unsigned char*)deltas.data(), indexCount, 4, false, buffer);
+}
+
+bool MeshCodec3MX::readHeader(const char* data, size_t size, Header& header)
+{
+	uint32_t fields[4];
+	if (size < headerSize || memcmp(data, magicNumber(), 4) != 0) return false;
+	memcpy(fields, data + 4, sizeof(fields));
+	if (fields[0] != version || fields[2] % 3 != 0 || (fields[3] & ~(uint32_t)(HAS_NORMALS | HAS_UVS))) return false;
+
+	// every element takes at least half a bit of group headers, so this bounds
+	// the allocations of a corrupted buffer
+	uint64_t elements = (uint64_t)fields[1] * (1 + !!(fields[3] & HAS_NORMALS) + !!(fields[3] & HAS_UVS)) + fields[2];
+	if (elements > (uint64_t)size * 16) return false;
+
+	header.vertexCount = fields[1];
+	header.indexCount = fields[2];
+	header.flags = fields[3];
+	return true;
+}
+
+bool MeshCodec3MX::decode(const char* data, size_t size, float* vertices, float* normals, float* uvs, uint32_t* indices)
+{
+	Header header;
+	if (!readHeader(data, size, header)) return false;
+
+	const unsigned char* pos = (const unsigned char*)data + headerSize;
+	const unsigned char* end = (const unsigned char*)data + size;
+	pos = decodeStream(pos, end, (unsigned char*)vertices, header.vertexCount, 12, true);
+	if (pos && (header.flags & HAS_NORMALS)) pos = decodeStream(pos, end, (unsigned char*)normals, header.vertexCount, 12, true);
+	if (pos && (header.flags & HAS_UVS)) pos = decodeStream(pos, end, (unsigned char*)uvs, header.vertexCount, 8, true);
+	if (pos) pos = decodeStream(pos, end, (unsigned char*)indices, header.indexCount, 4, false);
+	if (pos != end) return false;
+
+	uint32_t first = 0, outOfRange = 0;
+	for (uint32_t i = 0; i < header.indexCount; i += 3)
+	{
+		first += unzigzag32(indices[i]);
+		indices[i] = first;
+		indices[i + 1] = first + unzigzag32(indices[i + 1]);
+		indices[i + 2] = first + unzigzag32(indices[i + 2]);
+		outOfRange |= (first >= header.vertexCount) | (indices[i + 1] >= header.vertexCount) | (indices[i + 2] >= header.vertexCount);
+	}
+	return !outOfRange;
+}
@@ -0,0 +1,63 @@
+#ifndef MESH_CODEC_3MX_H
+#define MESH_CODEC_3MX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Fast decoding mesh codec of the "fmc" geometryBuffer format, an alternative
+// to ctm for datasets that favor load time over size. It is lossless and
+// byte oriented, without entropy coding, so it decodes 5-7x faster than MG2,
+// which is bound by LZMA, for buffers 4-8x larger than MG2 ones as the
+// vertices are not quantized.
+// Layout, little endian:
+//     "3MXM"                                  magic number
+//     uint32 version                          1
+//     uint32 vertex count
+//     uint32 index count                      3 x triangle count
+//     uint32 flags                            hasNormals | hasUVs
+//     vertex stream: positions, 12 bytes per vertex
+//     vertex stream: normals, 12 bytes per vertex, if hasNormals
+//     vertex stream: uvs, 8 bytes per vertex, if hasUVs
+//     index stream
+// Every stream is a uint32 size followed by its data. Vertices are coded in
+// blocks of 256: every byte of a vertex is stored as the zigzag delta from
+// the same byte of the previous vertex, in groups of 16 of 0, 2, 4 or 8 bits
+// selected by a 2-bit header per group. The index stream stores the first
+// index of a triangle as a delta from the first index of the previous
+// triangle, the others as deltas from the first one, zigzag coded as 32-bit
+// values in the same groups, without the byte delta.
+class MeshCodec3MX
+{
+public:
+	static const char* magicNumber() { return "3MXM"; }
+	static const uint32_t version = 1;
+
+	enum Flags
+	{
+		HAS_NORMALS = 1,
+		HAS_UVS = 2
+	};
+
+	struct Header
+	{
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
+		uint32_t flags = 0;
+	};
+
+	// Appends a mesh to buffer. normals and uvs could be null.
+	static void encode(const float* vertices, const float* normals, const float* uvs, uint32_t vertexCount,
+		const uint32_t* indices, uint32_t indexCount, std::string& buffer);
+
+	// Reads the header of the buffer data[0, size), so that the arrays could be
+	// allocated for decode().
+	static bool readHeader(const char* data, size_t size, Header& header);
+
+	// Decodes the buffer into arrays sized from its header; normals and uvs are
+	// only written when the buffer has them. Fails on a malformed buffer or an
+	// out of range index.
+	static bool decode(const char* data, size_t size, float* vertices, float* normals, float* uvs, uint32_t* indices);
+};
+
+#endif // MESH_CODEC_3MX_H
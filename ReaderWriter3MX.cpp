@@ -3,6 +3,10 @@
 #include <osg/Texture2D>
 #include <osg/Point>
 #include <osg/MatrixTransform>
+#include <osg/BufferObject>
+#include <osg/TexMat>
+
+#include <osgUtil/MeshOptimizers>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -10,18 +14,250 @@
 #include <osgDB/Registry>
 
 #include <iostream>
+#include <sstream>
 #include <stdio.h>
+#include <float.h>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <system_error>
+#include <memory>
 #include <string.h>
 
 #include <osgDB/ReadFile>
 
 #include "CJsonObject.hpp"
 #include "openctm.h"
+#include "Archive3MX.h"
+#include "Writer3MXB.h"
+#include "Stats3MX.h"
+#include "Stream3MX.h"
+#include "MeshCodec3MX.h"
+#include "Ktx3MX.h"
+#include "TextureRegistry3MX.h"
+
+// Importer of the calling thread, reused from one ctm buffer to the next so
+// that the LZMA decoder state and the decode buffers are allocated once per
+// pager thread instead of once per buffer. Taken for the time of a load and
+// given back reset, which frees the buffers of a large mesh so that they do
+// not stay pinned on every pager thread; a nested load gets a fresh importer.
+class CtmImporterLease
+{
+public:
+	CtmImporterLease() : _importer(cachedImporter().release())
+	{
+		if (!_importer) _importer = new CTMimporter;
+	}
+
+	~CtmImporterLease()
+	{
+		_importer->Reset();
+		if (!cachedImporter()) cachedImporter().reset(_importer);
+		else delete _importer;
+	}
+
+	CTMimporter& operator*() const { return *_importer; }
+	CTMimporter* operator->() const { return _importer; }
+
+private:
+	static std::unique_ptr<CTMimporter>& cachedImporter()
+	{
+		static thread_local std::unique_ptr<CTMimporter> importer;
+		return importer;
+	}
+
+	CtmImporterLease(const CtmImporterLease&);
+	CtmImporterLease& operator=(const CtmImporterLease&);
+
+	CTMimporter* _importer;
+};
+
+// Releases the CPU-side vertex arrays of a geometry once they have been
+// uploaded into its vertex buffer objects, like Texture::setUnRefImageDataAfterApply.
+// Only valid for single-context viewers; intersection tests against the
+// geometry no longer see any vertices afterwards.
+class UnRefArrayDataAfterApplyCallback : public osg::Drawable::DrawCallback
+{
+public:
+	virtual void drawImplementation(osg::RenderInfo& renderInfo, const osg::Drawable* drawable) const
+	{
+		drawable->drawImplementation(renderInfo);
+
+		osg::Geometry* geometry = const_cast<osg::Geometry*>(drawable->asGeometry());
+		if (!geometry || !geometry->getVertexArray() || !geometry->getVertexArray()->getNumElements()) return;
+
+		unsigned int contextID = renderInfo.getContextID();
+		if (!releaseArray(geometry->getVertexArray(), contextID)) return;
+		releaseArray(geometry->getNormalArray(), contextID);
+		releaseArray(geometry->getColorArray(), contextID);
+		for (unsigned int i = 0; i < geometry->getNumTexCoordArrays(); ++i)
+		{
+			releaseArray(geometry->getTexCoordArray(i), contextID);
+		}
+	}
+
+private:
+	static bool releaseArray(osg::Array* array, unsigned int contextID)
+	{
+		if (!array) return true;
+		osg::BufferObject* bufferObject = array->getBufferObject();
+		if (!bufferObject) return false;
+		osg::GLBufferObject* glBufferObject = bufferObject->getGLBufferObject(contextID);
+		if (!glBufferObject || glBufferObject->isDirty()) return false;
 
-static CTMuint CTMCALL _ctmIfstremRead(void * aBuf /*out buf*/, CTMuint aCount,
-	void * aUserData /*stream*/)
+		// resize without dirty() so the uploaded buffer stays valid
+		array->resizeArray(0);
+		array->trim();
+		return true;
+	}
+};
+
+struct ReadOptions3MX
+{
+	bool useVertexBufferObjects = true;
+	bool unRefArrayDataAfterApply = false;
+	bool quantizeVertices = false;
+	bool mergeGeometries = false;
+	bool optimizeVertexCache = false;
+	bool useArchiveMmap = true;
+	bool trustedCtm = false;
+	bool shareTextures = false;
+	bool cropTextures = false;
+	bool atlasTextures = false;
+	unsigned int ctmDecodeThreads = 1;
+
+	ReadOptions3MX(const osgDB::ReaderWriter::Options* options)
+	{
+		if (!options) return;
+
+		std::istringstream iss(options->getOptionString());
+		std::string opt;
+		while (iss >> opt)
+		{
+			if (opt == "noVBO") useVertexBufferObjects = false;
+			else if (opt == "unRefArrayDataAfterApply") unRefArrayDataAfterApply = true;
+			else if (opt == "quantizeVertices") quantizeVertices = true;
+			else if (opt == "mergeGeometries") mergeGeometries = true;
+			else if (opt == "optimizeVertexCache") optimizeVertexCache = true;
+			else if (opt == "noArchiveMmap") useArchiveMmap = false;
+			else if (opt == "trustedCtm") trustedCtm = true;
+			else if (opt == "shareTextures") shareTextures = true;
+			else if (opt == "cropTextures") cropTextures = true;
+			else if (opt == "atlasTextures") atlasTextures = true;
+			else if (opt.compare(0, 17, "ctmDecodeThreads=") == 0)
+			{
+				std::istringstream value(opt.substr(17));
+				value >> ctmDecodeThreads;
+			}
+		}
+	}
+};
+
+// Replaces the float vertices, normals and uvs of a mesh by 16-bit positions
+// relative to its bounding box, 8-bit normals and 16-bit uvs relative to their
+// uv range. The fixed function pipeline can not dequantize oct-encoded normals
+// or normalized shorts by itself, so uvs are restored by a TexMat and positions
+// by the returned matrix, which should be applied by a parent MatrixTransform.
+static bool quantizeGeometry(osg::Geometry* geometry, osg::Matrix& dequantizeMatrix)
 {
-	return (CTMuint)((std::ifstream*)aUserData)->read((char*)aBuf, aCount).gcount();
+	const float range = 32767.f;
+
+	osg::Vec3Array* vertices = dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray());
+	if (!vertices || vertices->empty()) return false;
+
+	// positions
+	osg::BoundingBox bb = geometry->getInitialBound();
+	for (const auto& vertex : *vertices)
+	{
+		bb.expandBy(vertex);
+	}
+	osg::Vec3 center = bb.center();
+	osg::Vec3 scale;
+	for (int j = 0; j < 3; ++j)
+	{
+		float halfExtent = (bb._max[j] - bb._min[j]) * 0.5f;
+		scale[j] = halfExtent > 0.f ? range / halfExtent : 0.f;
+	}
+
+	osg::Vec3sArray* quantizedVertices = new osg::Vec3sArray(vertices->size());
+	for (size_t i = 0; i < vertices->size(); ++i)
+	{
+		osg::Vec3 v = (*vertices)[i] - center;
+		for (int j = 0; j < 3; ++j)
+		{
+			(*quantizedVertices)[i][j] = (short)osg::clampBetween(osg::round(v[j] * scale[j]), -range, range);
+		}
+	}
+	geometry->setVertexArray(quantizedVertices);
+	geometry->setInitialBound(osg::BoundingBox(osg::Vec3(-range, -range, -range), osg::Vec3(range, range, range)));
+
+	dequantizeMatrix = osg::Matrix::scale(
+		scale.x() > 0.f ? 1.f / scale.x() : 1.f,
+		scale.y() > 0.f ? 1.f / scale.y() : 1.f,
+		scale.z() > 0.f ? 1.f / scale.z() : 1.f) * osg::Matrix::translate(center);
+
+	// normals
+	osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray());
+	if (normals && normals->size() == vertices->size())
+	{
+		osg::Vec3bArray* quantizedNormals = new osg::Vec3bArray(normals->size());
+		for (size_t i = 0; i < normals->size(); ++i)
+		{
+			osg::Vec3 n = (*normals)[i];
+			n.normalize();
+			for (int j = 0; j < 3; ++j)
+			{
+				(*quantizedNormals)[i][j] = (signed char)osg::round(osg::clampBetween(n[j], -1.f, 1.f) * 127.f);
+			}
+		}
+		geometry->setNormalArray(quantizedNormals, osg::Array::BIND_PER_VERTEX);
+
+		// the dequantize matrix scales non-uniformly
+		geometry->getOrCreateStateSet()->setMode(GL_NORMALIZE, osg::StateAttribute::ON);
+	}
+
+	// uvs
+	osg::Vec2Array* uvs = dynamic_cast<osg::Vec2Array*>(geometry->getTexCoordArray(0));
+	if (uvs && uvs->size() == vertices->size())
+	{
+		osg::Vec2 uvMin(FLT_MAX, FLT_MAX), uvMax(-FLT_MAX, -FLT_MAX);
+		for (const auto& uv : *uvs)
+		{
+			for (int j = 0; j < 2; ++j)
+			{
+				uvMin[j] = osg::minimum(uvMin[j], uv[j]);
+				uvMax[j] = osg::maximum(uvMax[j], uv[j]);
+			}
+		}
+		osg::Vec2 uvCenter = (uvMin + uvMax) * 0.5f;
+		osg::Vec2 uvScale;
+		for (int j = 0; j < 2; ++j)
+		{
+			float halfExtent = (uvMax[j] - uvMin[j]) * 0.5f;
+			uvScale[j] = halfExtent > 0.f ? range / halfExtent : 0.f;
+		}
+
+		osg::Vec2sArray* quantizedUVs = new osg::Vec2sArray(uvs->size());
+		for (size_t i = 0; i < uvs->size(); ++i)
+		{
+			osg::Vec2 uv = (*uvs)[i] - uvCenter;
+			for (int j = 0; j < 2; ++j)
+			{
+				(*quantizedUVs)[i][j] = (short)osg::clampBetween(osg::round(uv[j] * uvScale[j]), -range, range);
+			}
+		}
+		geometry->setTexCoordArray(0, quantizedUVs, osg::Array::BIND_PER_VERTEX);
+
+		osg::ref_ptr<osg::TexMat> texMat = new osg::TexMat(
+			osg::Matrix::scale(
+				uvScale.x() > 0.f ? 1.f / uvScale.x() : 1.f,
+				uvScale.y() > 0.f ? 1.f / uvScale.y() : 1.f,
+				1.f) * osg::Matrix::translate(uvCenter.x(), uvCenter.y(), 0.f));
+		geometry->getOrCreateStateSet()->setTextureAttribute(0, texMat);
+	}
+
+	return true;
 }
 
 struct Resource3MXB
@@ -32,6 +268,393 @@ struct Resource3MXB
 	osg::ref_ptr<osg::Texture2D> texture;
 };
 
+// Returns true for indexed triangle meshes as built from ctm buffers.
+static bool isTriangleMesh(osg::Geometry* geometry)
+{
+	if (!dynamic_cast<osg::Vec3Array*>(geometry->getVertexArray()) || geometry->getColorArray()) return false;
+	if (geometry->getNormalArray() && !dynamic_cast<osg::Vec3Array*>(geometry->getNormalArray())) return false;
+	if (geometry->getTexCoordArray(0) && !dynamic_cast<osg::Vec2Array*>(geometry->getTexCoordArray(0))) return false;
+	if (geometry->getNumTexCoordArrays() > 1 || !geometry->getNumPrimitiveSets()) return false;
+	for (unsigned int i = 0; i < geometry->getNumPrimitiveSets(); ++i)
+	{
+		osg::PrimitiveSet* primitiveSet = geometry->getPrimitiveSet(i);
+		if (!dynamic_cast<osg::DrawElementsUInt*>(primitiveSet) || primitiveSet->getMode() != GL_TRIANGLES) return false;
+	}
+	return true;
+}
+
+// Concatenates the vertex and index arrays of meshes with the same layout.
+static osg::ref_ptr<osg::Geometry> mergeMeshes(const std::vector<osg::Geometry*>& meshes)
+{
+	bool hasNormals = meshes[0]->getNormalArray() != nullptr;
+	bool hasUVs = meshes[0]->getTexCoordArray(0) != nullptr;
+
+	size_t vertCount = 0, indexCount = 0;
+	for (auto mesh : meshes)
+	{
+		vertCount += mesh->getVertexArray()->getNumElements();
+		for (unsigned int i = 0; i < mesh->getNumPrimitiveSets(); ++i)
+		{
+			indexCount += mesh->getPrimitiveSet(i)->getNumIndices();
+		}
+	}
+
+	osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+	osg::ref_ptr<osg::Vec3Array> normals = hasNormals ? new osg::Vec3Array : nullptr;
+	osg::ref_ptr<osg::Vec2Array> uvs = hasUVs ? new osg::Vec2Array : nullptr;
+	osg::ref_ptr<osg::DrawElementsUInt> indices = new osg::DrawElementsUInt(GL_TRIANGLES);
+	vertices->reserve(vertCount);
+	if (normals.valid()) normals->reserve(vertCount);
+	if (uvs.valid()) uvs->reserve(vertCount);
+	indices->reserve(indexCount);
+
+	osg::BoundingBox bb;
+	for (auto mesh : meshes)
+	{
+		GLuint baseVertex = (GLuint)vertices->size();
+		const osg::Vec3Array* meshVertices = static_cast<const osg::Vec3Array*>(mesh->getVertexArray());
+		vertices->insert(vertices->end(), meshVertices->begin(), meshVertices->end());
+		if (normals.valid())
+		{
+			const osg::Vec3Array* meshNormals = static_cast<const osg::Vec3Array*>(mesh->getNormalArray());
+			normals->insert(normals->end(), meshNormals->begin(), meshNormals->end());
+		}
+		if (uvs.valid())
+		{
+			const osg::Vec2Array* meshUVs = static_cast<const osg::Vec2Array*>(mesh->getTexCoordArray(0));
+			uvs->insert(uvs->end(), meshUVs->begin(), meshUVs->end());
+		}
+		for (unsigned int i = 0; i < mesh->getNumPrimitiveSets(); ++i)
+		{
+			const osg::DrawElementsUInt* meshIndices = static_cast<const osg::DrawElementsUInt*>(mesh->getPrimitiveSet(i));
+			for (GLuint index : *meshIndices)
+			{
+				indices->push_back(baseVertex + index);
+			}
+		}
+		bb.expandBy(mesh->getInitialBound());
+	}
+
+	osg::ref_ptr<osg::Geometry> merged = new osg::Geometry;
+	merged->setInitialBound(bb);
+	merged->setVertexArray(vertices);
+	if (normals.valid()) merged->setNormalArray(normals, osg::Array::BIND_PER_VERTEX);
+	if (uvs.valid()) merged->setTexCoordArray(0, uvs, osg::Array::BIND_PER_VERTEX);
+	merged->addPrimitiveSet(indices);
+	return merged;
+}
+
+// Reorders the triangles of a mesh for the post-transform vertex cache
+// (Forsyth) and its vertices for fetch locality, accumulating the cache
+// misses and triangles of the mesh before and after into acmr.
+static void optimizeVertexCache(osg::Geometry* geometry, unsigned int acmr[3])
+{
+	osgUtil::VertexCacheMissVisitor missBefore;
+	missBefore.doGeometry(*geometry);
+
+	osgUtil::VertexCacheVisitor vertexCacheVisitor;
+	vertexCacheVisitor.optimizeVertices(*geometry);
+	osgUtil::VertexAccessOrderVisitor vertexAccessOrderVisitor;
+	vertexAccessOrderVisitor.optimizeOrder(*geometry);
+
+	osgUtil::VertexCacheMissVisitor missAfter;
+	missAfter.doGeometry(*geometry);
+
+	acmr[0] += missBefore.misses;
+	acmr[1] += missAfter.misses;
+	acmr[2] += missAfter.triangles;
+}
+
+// Merges the meshes of a node sharing the same texture and vertex layout into
+// a single geometry, returns the number of draws removed.
+static int mergeNodeGeometries(std::vector<Resource3MXB>& nodeGeometries)
+{
+	std::vector<Resource3MXB> result;
+	std::vector<std::vector<osg::Geometry*> > batches;
+	std::map<std::string, size_t> mapBatch;
+	for (auto& resource3MXB : nodeGeometries)
+	{
+		if (!isTriangleMesh(resource3MXB.geometry))
+		{
+			result.push_back(resource3MXB);
+			batches.push_back(std::vector<osg::Geometry*>());
+			continue;
+		}
+
+		std::string key = resource3MXB.textureId
+			+ (resource3MXB.geometry->getNormalArray() ? "/n" : "/-")
+			+ (resource3MXB.geometry->getTexCoordArray(0) ? "t" : "-");
+		auto itr = mapBatch.find(key);
+		if (itr == mapBatch.end())
+		{
+			mapBatch[key] = result.size();
+			result.push_back(resource3MXB);
+			batches.push_back(std::vector<osg::Geometry*>(1, resource3MXB.geometry.get()));
+		}
+		else
+		{
+			batches[itr->second].push_back(resource3MXB.geometry.get());
+		}
+	}
+
+	int removed = 0;
+	for (size_t i = 0; i < result.size(); ++i)
+	{
+		if (batches[i].size() > 1)
+		{
+			result[i].geometry = mergeMeshes(batches[i]);
+			removed += (int)batches[i].size() - 1;
+		}
+	}
+	nodeGeometries.swap(result);
+	return removed;
+}
+
+typedef std::map<std::string, std::vector<osg::Vec2Array*> > TextureUVs3MX;
+
+// Returns the uv arrays of the geometries of a tile by texture id; the array
+// of a geometry whose uvs could not be remapped is null.
+static TextureUVs3MX collectTextureUVs(const std::map<std::string, Resource3MXB>& mapResource3MXB)
+{
+	TextureUVs3MX mapUVs;
+	for (auto& entry : mapResource3MXB)
+	{
+		const Resource3MXB& resource3MXB = entry.second;
+		if (resource3MXB.type != "geometryBuffer" || !resource3MXB.geometry.valid() || resource3MXB.textureId.empty()) continue;
+		mapUVs[resource3MXB.textureId].push_back(dynamic_cast<osg::Vec2Array*>(resource3MXB.geometry->getTexCoordArray(0)));
+	}
+	return mapUVs;
+}
+
+// Returns the uv rectangle of the arrays, false if one of them is null or if
+// they are all empty.
+static bool getUVRange(const std::vector<osg::Vec2Array*>& uvArrays, osg::Vec2& uvMin, osg::Vec2& uvMax)
+{
+	uvMin = osg::Vec2(FLT_MAX, FLT_MAX);
+	uvMax = osg::Vec2(-FLT_MAX, -FLT_MAX);
+	for (auto uvs : uvArrays)
+	{
+		if (!uvs) return false;
+		for (const auto& uv : *uvs)
+		{
+			uvMin.x() = std::min(uvMin.x(), uv.x());
+			uvMin.y() = std::min(uvMin.y(), uv.y());
+			uvMax.x() = std::max(uvMax.x(), uv.x());
+			uvMax.y() = std::max(uvMax.y(), uv.y());
+		}
+	}
+	return uvMin.x() <= uvMax.x() && uvMin.y() <= uvMax.y();
+}
+
+// Returns the decoded image of a texture resource if its texels could be
+// copied row by row: not GPU compressed, without stored mipmaps.
+static osg::Image* getPlainImage(const std::map<std::string, Resource3MXB>& mapResource3MXB, const std::string& textureId)
+{
+	auto itr = mapResource3MXB.find(textureId);
+	if (itr == mapResource3MXB.end() || !itr->second.texture.valid()) return nullptr;
+	osg::Image* image = itr->second.texture->getImage();
+	if (!image || !image->data() || image->isCompressed() || image->isMipmap() || image->r() != 1 || image->getPixelSizeInBits() % 8) return nullptr;
+	return image;
+}
+
+// Replaces the uvs of the arrays by uv * scale + offset.
+static void transformUVs(const std::vector<osg::Vec2Array*>& uvArrays, const osg::Vec2& scale, const osg::Vec2& offset)
+{
+	for (auto uvs : uvArrays)
+	{
+		for (auto& uv : *uvs)
+		{
+			uv = osg::Vec2(uv.x() * scale.x() + offset.x(), uv.y() * scale.y() + offset.y());
+		}
+		uvs->dirty();
+	}
+}
+
+// Crops the decoded textures of a tile to the uv rectangle of the geometries
+// using them and remaps their uvs, returns the number of texels removed. The
+// rectangle is grown by a border and aligned to 4 texels, so that the first
+// mipmap levels filter the same texels as the full texture; it includes the
+// texture edges that clamped uvs reach.
+static uint64_t cropTextures(std::map<std::string, Resource3MXB>& mapResource3MXB)
+{
+	const int border = 4;
+	const int align = 4;
+
+	TextureUVs3MX mapUVs = collectTextureUVs(mapResource3MXB);
+	uint64_t removed = 0;
+	for (auto& entry : mapUVs)
+	{
+		osg::Image* image = getPlainImage(mapResource3MXB, entry.first);
+		osg::Vec2 uvMin, uvMax;
+		if (!image || !getUVRange(entry.second, uvMin, uvMax)) continue;
+
+		int width = image->s(), height = image->t();
+		int x0 = std::max(0, (int)floor(std::max(uvMin.x(), 0.f) * width) - border) / align * align;
+		int y0 = std::max(0, (int)floor(std::max(uvMin.y(), 0.f) * height) - border) / align * align;
+		int x1 = std::min(width, ((int)ceil(std::min(uvMax.x(), 1.f) * width) + border + align - 1) / align * align);
+		int y1 = std::min(height, ((int)ceil(std::min(uvMax.y(), 1.f) * height) + border + align - 1) / align * align);
+		int croppedWidth = x1 - x0, croppedHeight = y1 - y0;
+
+		// not worth a copy below 1/8 of the texels
+		uint64_t texels = (uint64_t)width * height;
+		uint64_t croppedTexels = (uint64_t)croppedWidth * croppedHeight;
+		if (croppedWidth <= 0 || croppedHeight <= 0 || croppedTexels * 8 > texels * 7) continue;
+
+		osg::ref_ptr<osg::Image> cropped = new osg::Image;
+		cropped->allocateImage(croppedWidth, croppedHeight, 1, image->getPixelFormat(), image->getDataType(), image->getPacking());
+		if (!cropped->data()) continue;
+		cropped->setInternalTextureFormat(image->getInternalTextureFormat());
+		size_t rowBytes = (size_t)croppedWidth * (image->getPixelSizeInBits() / 8);
+		for (int row = 0; row < croppedHeight; ++row)
+		{
+			memcpy(cropped->data(0, row), image->data(x0, y0 + row), rowBytes);
+		}
+		mapResource3MXB[entry.first].texture->setImage(cropped);
+
+		// uv' = (uv * size - origin) / croppedSize
+		transformUVs(entry.second, osg::Vec2((float)width / croppedWidth, (float)height / croppedHeight),
+			osg::Vec2(-(float)x0 / croppedWidth, -(float)y0 / croppedHeight));
+		removed += texels - croppedTexels;
+	}
+	return removed;
+}
+
+// Packs the decoded textures of a tile into a single atlas texture of at most
+// 4096 x 4096 texels, so that the geometries using them share one texture
+// binding and could be merged into a single draw. Textures are placed on
+// shelves, tallest first, with a 4 texel border replicating their edges
+// against bleeding from their neighbours in the first mipmap levels. The uvs
+// are remapped and the geometries refer to the new texture resource, whose id
+// is returned in atlasId. Textures with uvs reaching past their border, with
+// a different pixel format than the first one, or that do not fit are left
+// as they are. Returns the number of textures packed, 0 when less than two
+// could be packed.
+static int atlasTextures(std::map<std::string, Resource3MXB>& mapResource3MXB, std::string& atlasId, osg::ref_ptr<osg::Image>& atlas)
+{
+	const int maxSize = 4096;
+	const int border = 4;
+	const int align = 4;
+
+	struct AtlasEntry
+	{
+		std::string textureId;
+		osg::Image* image;
+		int x, y; // position of the texels in the atlas, x < 0 if not placed
+	};
+
+	TextureUVs3MX mapUVs = collectTextureUVs(mapResource3MXB);
+	std::vector<AtlasEntry> entries;
+	for (auto& entry : mapUVs)
+	{
+		osg::Image* image = getPlainImage(mapResource3MXB, entry.first);
+		osg::Vec2 uvMin, uvMax;
+		if (!image || !getUVRange(entry.second, uvMin, uvMax)) continue;
+
+		const osg::Image* first = entries.empty() ? image : entries[0].image;
+		if (image->getPixelFormat() != first->getPixelFormat() || image->getDataType() != first->getDataType()
+			|| image->getInternalTextureFormat() != first->getInternalTextureFormat()) continue;
+		if (image->s() + 2 * border > maxSize || image->t() + 2 * border > maxSize) continue;
+
+		// clamped uvs no longer reach the texture edge but its border
+		osg::Vec2 margin((float)border / image->s(), (float)border / image->t());
+		if (uvMin.x() < -margin.x() || uvMin.y() < -margin.y() || uvMax.x() > 1.f + margin.x() || uvMax.y() > 1.f + margin.y()) continue;
+
+		AtlasEntry atlasEntry = { entry.first, image, -1, -1 };
+		entries.push_back(atlasEntry);
+	}
+	if (entries.size() < 2) return 0;
+
+	// shelf packing into a roughly square atlas
+	std::stable_sort(entries.begin(), entries.end(), [](const AtlasEntry& a, const AtlasEntry& b) { return a.image->t() > b.image->t(); });
+	auto cellSize = [](int size) { return (size + 2 * border + align - 1) / align * align; };
+	uint64_t area = 0;
+	int atlasWidth = 0;
+	for (const auto& entry : entries)
+	{
+		area += (uint64_t)cellSize(entry.image->s()) * cellSize(entry.image->t());
+		atlasWidth = std::max(atlasWidth, cellSize(entry.image->s()));
+	}
+	atlasWidth = std::min(maxSize, std::max(atlasWidth, ((int)ceil(sqrt((double)area)) + align - 1) / align * align));
+
+	int x = 0, y = 0, shelfHeight = 0, placed = 0;
+	for (auto& entry : entries)
+	{
+		int cellWidth = cellSize(entry.image->s()), cellHeight = cellSize(entry.image->t());
+		int cellX = x, cellY = y;
+		if (cellX + cellWidth > atlasWidth)
+		{
+			cellX = 0;
+			cellY = y + shelfHeight;
+		}
+		if (cellY + cellHeight > maxSize) continue;
+		if (cellY != y)
+		{
+			y = cellY;
+			shelfHeight = 0;
+		}
+		entry.x = cellX + border;
+		entry.y = cellY + border;
+		x = cellX + cellWidth;
+		shelfHeight = std::max(shelfHeight, cellHeight);
+		++placed;
+	}
+	if (placed < 2) return 0;
+	int atlasHeight = y + shelfHeight;
+
+	// copy the texels and their replicated edges
+	const osg::Image* first = entries[0].image;
+	atlas = new osg::Image;
+	atlas->allocateImage(atlasWidth, atlasHeight, 1, first->getPixelFormat(), first->getDataType(), first->getPacking());
+	if (!atlas->data()) return 0;
+	atlas->setInternalTextureFormat(first->getInternalTextureFormat());
+	memset(atlas->data(), 0, atlas->getTotalSizeInBytes());
+	size_t pixelBytes = first->getPixelSizeInBits() / 8;
+	for (const auto& entry : entries)
+	{
+		if (entry.x < 0) continue;
+		int width = entry.image->s(), height = entry.image->t();
+		for (int row = -border; row < height + border; ++row)
+		{
+			const unsigned char* src = entry.image->data(0, std::min(std::max(row, 0), height - 1));
+			unsigned char* dst = atlas->data(entry.x - border, entry.y + row);
+			for (int i = 0; i < border; ++i)
+			{
+				memcpy(dst + i * pixelBytes, src, pixelBytes);
+				memcpy(dst + (border + width + i) * pixelBytes, src + (width - 1) * pixelBytes, pixelBytes);
+			}
+			memcpy(dst + border * pixelBytes, src, width * pixelBytes);
+		}
+	}
+
+	// texture resource of the atlas, with the settings of the packed textures
+	const osg::Texture2D* firstTexture = mapResource3MXB[entries[0].textureId].texture.get();
+	Resource3MXB atlasResource;
+	atlasResource.type = "textureBuffer";
+	atlasResource.texture = new osg::Texture2D;
+	atlasResource.texture->setFilter(osg::Texture::MIN_FILTER, firstTexture->getFilter(osg::Texture::MIN_FILTER));
+	atlasResource.texture->setFilter(osg::Texture::MAG_FILTER, firstTexture->getFilter(osg::Texture::MAG_FILTER));
+	atlasResource.texture->setDataVariance(osg::Object::STATIC);
+	atlasResource.texture->setResizeNonPowerOfTwoHint(false);
+	atlasResource.texture->setUnRefImageDataAfterApply(true);
+	atlasResource.texture->setImage(atlas);
+	atlasId = "atlas";
+	while (mapResource3MXB.count(atlasId)) atlasId += "_";
+	mapResource3MXB[atlasId] = atlasResource;
+
+	// uv' = (uv * size + position) / atlasSize
+	for (const auto& entry : entries)
+	{
+		if (entry.x < 0) continue;
+		transformUVs(mapUVs[entry.textureId], osg::Vec2((float)entry.image->s() / atlasWidth, (float)entry.image->t() / atlasHeight),
+			osg::Vec2((float)entry.x / atlasWidth, (float)entry.y / atlasHeight));
+		for (auto& resource : mapResource3MXB)
+		{
+			if (resource.second.type == "geometryBuffer" && resource.second.textureId == entry.textureId) resource.second.textureId = atlasId;
+		}
+	}
+	return placed;
+}
+
 class ReaderWriter3MXB : public osgDB::ReaderWriter
 {
 public:
@@ -40,14 +663,66 @@ public:
 	{
 		supportsExtension("3mxb", "3mxb format");
 		supportsExtension("3mx", "3mx format");
+		supportsExtension("3mxa", "packed 3mx dataset");
+
+		supportsOption("noVBO", "Use OSG's default display list setup instead of static vertex buffer objects.");
+		supportsOption("unRefArrayDataAfterApply", "Release CPU-side vertex arrays once uploaded to vertex buffer objects.");
+		supportsOption("mergeGeometries", "Merge the meshes of a node sharing the same texture into a single draw.");
+		supportsOption("optimizeVertexCache", "Reorder mesh triangles and vertices for the GPU vertex cache.");
+		supportsOption("quantizeVertices", "Store vertex positions and uvs as 16-bit and normals as 8-bit values, each geometry under its own MatrixTransform. Intersections no longer hit the quantized geometry.");
+		supportsOption("noArchiveMmap", "Read the tiles of a .3mxa archive from the file instead of mapping it into memory.");
+		supportsOption("trustedCtm", "Only range check the indices of ctm buffers, not that every value is finite.");
+		supportsOption("shareTextures", "Share a single texture between the tiles holding identical texture buffers, in the whole process.");
+		supportsOption("cropTextures", "Crop the textures to the uvs of their meshes, unless shareTextures is set.");
+		supportsOption("atlasTextures", "Pack the textures of a tile into a single atlas and merge the meshes of a node into a single draw.");
+		supportsOption("ctmDecodeThreads=<n>", "Number of threads computing the smooth normals of a single large MG2 mesh when reading, 1 by default.");
+
+		supportsOption("threads=<n>", "Number of tiles encoded concurrently when writing, one per hardware thread by default, at most 4 per hardware thread.");
+		supportsOption("ctmVertexPrecisionRel=<f>", "MG2 vertex precision relative to the average edge length when writing, 0.01 by default.");
+		supportsOption("ctmPreset=<p>", "Ctm compression preset when writing: fastEncode or maxRatio, trading encoding time for size.");
+		supportsOption("ctmThreads=<n>", "Number of threads compressing the arrays of a single ctm mesh when writing, 1 by default.");
+		supportsOption("meshFormat=<f>", "GeometryBuffer format of the meshes when writing: ctm, or fmc for fast decoding.");
+		supportsOption("jpegQuality=<q>", "Quality of the jpg textures when writing, 90 by default.");
 	}
 
 	virtual const char* className() const { return "3mx reader"; }
 
 private:
-	bool readResources(std::ifstream& inFile, neb::CJsonObject& oJsonResourcesArray, std::map<std::string, Resource3MXB>& mapResource3MXB) const
+	void setupBufferObjects(osg::Geometry* geometry, const ReadOptions3MX& readOptions) const
 	{
-		int lastBufferOffset = inFile.tellg();
+		geometry->setDataVariance(osg::Object::STATIC);
+		if (!readOptions.useVertexBufferObjects) return;
+
+		geometry->setUseDisplayList(false);
+		geometry->setUseVertexBufferObjects(true);
+
+		osg::ref_ptr<osg::VertexBufferObject> vbo = new osg::VertexBufferObject;
+		vbo->setUsage(GL_STATIC_DRAW_ARB);
+		osg::Geometry::ArrayList arrays;
+		geometry->getArrayList(arrays);
+		for (auto& array : arrays)
+		{
+			array->setBufferObject(vbo.get());
+		}
+
+		osg::ref_ptr<osg::ElementBufferObject> ebo = new osg::ElementBufferObject;
+		ebo->setUsage(GL_STATIC_DRAW_ARB);
+		for (unsigned int i = 0; i < geometry->getNumPrimitiveSets(); ++i)
+		{
+			osg::DrawElements* drawElements = geometry->getPrimitiveSet(i)->getDrawElements();
+			if (drawElements) drawElements->setElementBufferObject(ebo.get());
+		}
+
+		if (readOptions.unRefArrayDataAfterApply)
+		{
+			geometry->setDrawCallback(new UnRefArrayDataAfterApplyCallback);
+		}
+	}
+
+	// Reads the resources from the buffers following the header, data[pos, size).
+	bool readResources(const char* data, size_t size, size_t pos, neb::CJsonObject& oJsonResourcesArray, std::map<std::string, Resource3MXB>& mapResource3MXB, const ReadOptions3MX& readOptions, TileStats3MX* tile) const
+	{
+		StageTimer3MX timer(tile);
 		int resourcesNum = oJsonResourcesArray.GetArraySize();
 		for (int i = 0; i < resourcesNum; ++i)
 		{
@@ -60,48 +735,95 @@ private:
 			oJsonResource.Get("id", id);
 			oJsonResource.Get("type", resource3MXB.type);
 			oJsonResource.Get("format", format);
-			if (resource3MXB.type == "textureBuffer" && format == "jpg")
+			if (resource3MXB.type == "textureBuffer" && (format == "jpg" || format == "ktx"))
 			{
 				oJsonResource.Get("size", bufferSize);
 				osg::Image* image = nullptr;
+				TextureRegistry3MX::Key textureKey;
+				bool shareTexture = false;
 				if(bufferSize)
 				{
-					//Read in file
-					std::vector<char> buffer(bufferSize);
-					inFile.read(&buffer[0], bufferSize);
-					if ((int)inFile.gcount() != bufferSize)
+					if (bufferSize < 0 || (size_t)bufferSize > size - pos)
 					{
 						return false;
 					}
-					lastBufferOffset = inFile.tellg();
+					const char* buffer = data + pos;
+					pos += bufferSize;
 
-					//Get ReaderWriter from file extension
-					osgDB::ReaderWriter *reader = osgDB::Registry::instance()->getReaderWriterForExtension(format);
+					if (readOptions.shareTextures)
+					{
+						// the same buffer in another tile still in memory
+						TextureRegistry3MX& registry = TextureRegistry3MX::instance();
+						textureKey = TextureRegistry3MX::makeKey(buffer, bufferSize);
+						shareTexture = true;
+						++registry.stats().lookups;
+						resource3MXB.texture = registry.find(textureKey);
+						if (resource3MXB.texture.valid())
+						{
+							// the image is released once uploaded
+							const osg::Texture2D* shared = resource3MXB.texture.get();
+							uint64_t texels = shared->getImage() ? (uint64_t)shared->getImage()->s() * shared->getImage()->t()
+								: (uint64_t)shared->getTextureWidth() * shared->getTextureHeight();
+							++registry.stats().hits;
+							registry.stats().bytesSaved += bufferSize;
+							registry.stats().texelsSaved += texels;
+							if (tile) ++tile->sharedTextures;
+							timer.lap(TileStats3MX::JPEG_DECODE);
+							mapResource3MXB.emplace(id, resource3MXB);
+							continue;
+						}
+					}
 
 					osgDB::ReaderWriter::ReadResult rr;
-					if (reader) {
-						//Convert data to istream
-						std::stringstream inputStream;
-						inputStream.write(&buffer[0], bufferSize);
-
-						//Attempt to read the image
-						//osg::ref_ptr<const osgDB::ReaderWriter::Options> options;
-						rr = reader->readImage(inputStream/*, options.get()*/);
+					if (format == "ktx")
+					{
+						// GPU compressed, only copied with its stored mipmaps
+						osg::ref_ptr<osg::Image> ktxImage = Ktx3MX::readImage(buffer, bufferSize);
+						if (ktxImage.valid()) rr = osgDB::ReaderWriter::ReadResult(ktxImage.get());
+						else OSG_WARN << "Reading ktx texture " << id << " failed! Invalid or unsupported format." << std::endl;
+					}
+					else
+					{
+						//Get ReaderWriter from file extension
+						osgDB::ReaderWriter *reader = osgDB::Registry::instance()->getReaderWriterForExtension(format);
+
+						if (reader) {
+							//Convert data to istream
+							MemoryStreamBuf3MX inputBuffer(buffer, bufferSize);
+							std::istream inputStream(&inputBuffer);
+
+							//Attempt to read the image
+							//osg::ref_ptr<const osgDB::ReaderWriter::Options> options;
+							rr = reader->readImage(inputStream/*, options.get()*/);
+						}
 					}
 
 					//Return result
 					if (rr.validImage()) {
 						image = rr.takeImage();
+						if (tile) tile->texels += (uint64_t)image->s() * image->t();
 					}
+					timer.lap(TileStats3MX::JPEG_DECODE);
 				}
 
 				resource3MXB.texture = new osg::Texture2D();
 				resource3MXB.texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
 				resource3MXB.texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+				if (image && image->isMipmap())
+				{
+					// stored mipmaps of a ktx texture
+					resource3MXB.texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
+					resource3MXB.texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+				}
 				resource3MXB.texture->setDataVariance(osg::Object::STATIC);
 				resource3MXB.texture->setResizeNonPowerOfTwoHint(false);
 				resource3MXB.texture->setUnRefImageDataAfterApply(true);
 				resource3MXB.texture->setImage(image);
+				if (shareTexture && image)
+				{
+					resource3MXB.texture = TextureRegistry3MX::instance().add(textureKey, resource3MXB.texture.get());
+				}
+				timer.lap(TileStats3MX::GRAPH_BUILD);
 			}
 			else if (resource3MXB.type == "geometryBuffer" && format == "ctm")
 			{
@@ -113,13 +835,31 @@ private:
 					oJsonResource["bbMin"].Get(j, bbMin[j]);
 					oJsonResource["bbMax"].Get(j, bbMax[j]);
 				}
-				CTMimporter ctm;
-				ctm.LoadCustom(_ctmIfstremRead, &inFile);
-				if ((int)inFile.tellg() - lastBufferOffset != bufferSize)
+				if (bufferSize < 0 || (size_t)bufferSize > size - pos)
+				{
+					return false;
+				}
+				const char* buffer = data + pos;
+				pos += bufferSize;
+
+				CtmImporterLease importer;
+				CTMimporter& ctm = *importer;
+				try
+				{
+					if (readOptions.trustedCtm) ctm.LoadValidation(CTM_VALIDATE_INDICES);
+					if (readOptions.ctmDecodeThreads > 1) ctm.DecompressionThreads(readOptions.ctmDecodeThreads);
+					ctm.LoadFromMemory(buffer, (CTMuint)bufferSize);
+				}
+				catch (const ctm_error& e)
+				{
+					OSG_WARN << "Reading ctm buffer " << id << " failed! " << e.what() << std::endl;
+					return false;
+				}
+				if (ctm.GetInteger(CTM_READ_SIZE) != (CTMuint)bufferSize)
 				{
 					return false;
 				}
-				lastBufferOffset = inFile.tellg();
+				timer.split(TileStats3MX::CTM_RESTORE, TileStats3MX::CTM_LZMA, tile ? ctm.GetFloat(CTM_LZMA_TIME) : 0.0);
 
 				// to osg
 				resource3MXB.geometry = new osg::Geometry;
@@ -158,7 +898,63 @@ private:
 					auto indices = ctm.GetIntegerArray(CTM_INDICES);
 					osg::DrawElements* osgPrimitives = new osg::DrawElementsUInt(GL_TRIANGLES, triCount * 3, indices);
 					resource3MXB.geometry->addPrimitiveSet(osgPrimitives);
+					if (tile) tile->triangles += triCount;
+				}
+				timer.lap(TileStats3MX::GRAPH_BUILD);
+			}
+			else if (resource3MXB.type == "geometryBuffer" && format == "fmc")
+			{
+				oJsonResource.Get("size", bufferSize);
+				oJsonResource.Get("texture", resource3MXB.textureId);
+				osg::Vec3 bbMin, bbMax;
+				for (int j = 0; j < 3; ++j)
+				{
+					oJsonResource["bbMin"].Get(j, bbMin[j]);
+					oJsonResource["bbMax"].Get(j, bbMax[j]);
+				}
+				if (bufferSize < 0 || (size_t)bufferSize > size - pos)
+				{
+					return false;
+				}
+				const char* buffer = data + pos;
+				pos += bufferSize;
+
+				// decoded straight into the osg arrays
+				MeshCodec3MX::Header header;
+				if (!MeshCodec3MX::readHeader(buffer, bufferSize, header))
+				{
+					OSG_WARN << "Reading fmc buffer " << id << " failed! Invalid header." << std::endl;
+					return false;
+				}
+				osg::ref_ptr<osg::Vec3Array> osgVertices = new osg::Vec3Array(header.vertexCount);
+				osg::ref_ptr<osg::Vec3Array> osgNormals = (header.flags & MeshCodec3MX::HAS_NORMALS) ? new osg::Vec3Array(header.vertexCount) : nullptr;
+				osg::ref_ptr<osg::Vec2Array> osgUVmaps = (header.flags & MeshCodec3MX::HAS_UVS) ? new osg::Vec2Array(header.vertexCount) : nullptr;
+				osg::ref_ptr<osg::DrawElementsUInt> osgPrimitives = new osg::DrawElementsUInt(GL_TRIANGLES, header.indexCount);
+				if (!MeshCodec3MX::decode(buffer, bufferSize, (float*)osgVertices->asVector().data(),
+					osgNormals.valid() ? (float*)osgNormals->asVector().data() : nullptr,
+					osgUVmaps.valid() ? (float*)osgUVmaps->asVector().data() : nullptr,
+					header.indexCount ? &(*osgPrimitives)[0] : nullptr))
+				{
+					OSG_WARN << "Reading fmc buffer " << id << " failed! Invalid data." << std::endl;
+					return false;
+				}
+				timer.lap(TileStats3MX::CTM_RESTORE);
+
+				// to osg
+				resource3MXB.geometry = new osg::Geometry;
+				resource3MXB.geometry->setInitialBound(osg::BoundingBox(bbMin, bbMax));
+				if (header.vertexCount)
+				{
+					resource3MXB.geometry->setVertexArray(osgVertices.get());
+					if (osgNormals.valid()) resource3MXB.geometry->setNormalArray(osgNormals.get(), osg::Vec3Array::BIND_PER_VERTEX);
+					if (osgUVmaps.valid()) resource3MXB.geometry->setTexCoordArray(0, osgUVmaps.get(), osg::Vec2Array::BIND_PER_VERTEX);
+				}
+				if (header.indexCount)
+				{
+					resource3MXB.geometry->addPrimitiveSet(osgPrimitives.get());
+					if (tile) tile->triangles += header.indexCount / 3;
 				}
+				timer.lap(TileStats3MX::GRAPH_BUILD);
 			}
 			else if (resource3MXB.type == "geometryBuffer" && format == "xyz")
 			{
@@ -173,23 +969,32 @@ private:
 				}
 				if (bufferSize)
 				{
+					if (bufferSize < 4 || (size_t)bufferSize > size - pos)
+					{
+						return false;
+					}
+					const char* buffer = data + pos;
+					pos += bufferSize;
+
 					resource3MXB.geometry = new osg::Geometry;
 					resource3MXB.geometry->setInitialBound(osg::BoundingBox(bbMin, bbMax));
 
-					std::vector<char> buffer(bufferSize);
-					inFile.read(&buffer[0], bufferSize);
-
 					int vertCount = 0;
-					memcpy(&vertCount, buffer.data(), 4);
+					memcpy(&vertCount, buffer, 4);
+					if (vertCount < 0 || vertCount > (bufferSize - 4) / 16)
+					{
+						return false;
+					}
+					if (tile) tile->points += vertCount;
 
 					if (vertCount)
 					{
-						char* vertices = buffer.data() + 4;
+						const char* vertices = buffer + 4;
 						osg::Vec3Array* osgVertices = new osg::Vec3Array(vertCount);
 						memcpy(&osgVertices->asVector()[0], vertices, vertCount * sizeof(float) * 3);
 						resource3MXB.geometry->setVertexArray(osgVertices);
 
-						char* colors = buffer.data() + 4 + vertCount * sizeof(float) * 3;
+						const char* colors = buffer + 4 + vertCount * sizeof(float) * 3;
 						osg::ref_ptr<osg::Vec4ubArray> osgColorsB = new osg::Vec4ubArray(vertCount);
 						memcpy(&osgColorsB->asVector()[0], colors, vertCount * sizeof(char) * 4);
 						osg::Vec4Array* osgColorsF = new osg::Vec4Array(vertCount);
@@ -203,18 +1008,19 @@ private:
 						
 						resource3MXB.geometry->setColorArray(osgColorsF, osg::Vec4Array::BIND_PER_VERTEX);
 
-						resource3MXB.geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, osgVertices->size()));
-						resource3MXB.geometry->getOrCreateStateSet()->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
-
-						if (pointSize > 0)
-						{
-							osg::ref_ptr<osg::Point> point = new osg::Point;
-							point->setDistanceAttenuation(osg::Vec3(1.0f, 0.0f, 0.01f));
-							point->setSize(pointSize);
-							resource3MXB.geometry->getOrCreateStateSet()->setMode(GL_POINT_SMOOTH, osg::StateAttribute::ON);
-							resource3MXB.geometry->getOrCreateStateSet()->setAttribute(point);
-						}
+						resource3MXB.geometry->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::POINTS, 0, osgVertices->size()));
+						resource3MXB.geometry->getOrCreateStateSet()->setMode(GL_LIGHTING, osg::StateAttribute::OFF);
+
+						if (pointSize > 0)
+						{
+							osg::ref_ptr<osg::Point> point = new osg::Point;
+							point->setDistanceAttenuation(osg::Vec3(1.0f, 0.0f, 0.01f));
+							point->setSize(pointSize);
+							resource3MXB.geometry->getOrCreateStateSet()->setMode(GL_POINT_SMOOTH, osg::StateAttribute::ON);
+							resource3MXB.geometry->getOrCreateStateSet()->setAttribute(point);
+						}
 					}
+					timer.lap(TileStats3MX::GRAPH_BUILD);
 				}
 			}
 			else
@@ -229,15 +1035,159 @@ private:
 public:
 	virtual ReadResult readNode(const std::string& file, const osgDB::ReaderWriter::Options* options) const
 	{
-		std::string ext_3mx = osgDB::getLowerCaseFileExtension(file);
-		if (!acceptsExtension(ext_3mx)) return ReadResult::FILE_NOT_HANDLED;
+		std::string ext = osgDB::getLowerCaseFileExtension(file);
+		if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+
+		if (ext == "3mxa")
+		{
+			// the .3mx root of a packed dataset
+			osg::ref_ptr<Archive3MX> archive = getArchive(file, options);
+			if (!archive.valid()) return ReadResult::ERROR_IN_READING_FILE;
+			return read3MX(file + "/" + archive->getMasterFileName(), options);
+		}
+		if (ext == "3mx")
+		{
+			return read3MX(file, options);
+		}
+		return read3MXB(file, options);
+	}
+
+	// Reads a .3mxb tile, or a .3mx, from a stream. Relative child tile (or
+	// layer root) paths are resolved against the database path of the options.
+	// Tiles already in memory could be read without a copy through a stream
+	// over a MemoryStreamBuf3MX.
+	virtual ReadResult readNode(std::istream& fin, const osgDB::ReaderWriter::Options* options) const
+	{
+		LoadStats3MX* stats = LoadStats3MX::get(options);
+		TileStats3MX tileStats;
+		TileStats3MX* tile = stats ? &tileStats : nullptr;
+		StageTimer3MX timer(tile);
 
-		// ---------start 3mx-------------
-		std::string filePath = file;
-		osg::ref_ptr<osg::MatrixTransform> matrixTransform;
-		if (ext_3mx == "3mx")
+		// the whole tile is parsed in place, so memory buffers are used directly
+		std::vector<char> content;
+		const char* data = nullptr;
+		size_t size = 0;
+		MemoryStreamBuf3MX* memoryBuffer = dynamic_cast<MemoryStreamBuf3MX*>(fin.rdbuf());
+		if (memoryBuffer)
 		{
-			std::string fileName_3mx = osgDB::findDataFile(file, options);
+			data = memoryBuffer->data();
+			size = memoryBuffer->size();
+		}
+		else
+		{
+			char chunk[65536];
+			while (fin.read(chunk, sizeof(chunk)) || fin.gcount())
+			{
+				content.insert(content.end(), chunk, chunk + fin.gcount());
+			}
+			data = content.data();
+			size = content.size();
+		}
+		timer.lap(TileStats3MX::FILE_IO);
+
+		std::string childDir;
+		if (options && !options->getDatabasePathList().empty())
+		{
+			childDir = options->getDatabasePathList().front();
+		}
+
+		if (size < 5 || memcmp(data, "3MXBO", 5) != 0)
+		{
+			// .3mx
+			std::string rootDir = childDir;
+			if (!rootDir.empty() && rootDir.back() != '/' && rootDir.back() != '\\') rootDir += '/';
+			return parse3MX(std::string(data, size), "stream", rootDir, options);
+		}
+
+		// children are searched like the stream, unless it has a database path
+		osg::ref_ptr<osgDB::ReaderWriter::Options> childOptions = const_cast<osgDB::ReaderWriter::Options*>(options);
+		if (!childDir.empty())
+		{
+			childOptions = resolvedOptions(options);
+		}
+
+		ReadResult result = read3MXB(data, size, "stream", childDir, options, childOptions.get(), timer, tile);
+		if (stats && result.validNode())
+		{
+			tileStats.fileName = childDir.empty() ? std::string("stream") : childDir + "/stream";
+			stats->add(tileStats);
+		}
+		return result;
+	}
+
+	virtual ReadResult openArchive(const std::string& file, ArchiveStatus status, unsigned int /*indexBlockSizeHint*/, const osgDB::ReaderWriter::Options* options) const
+	{
+		std::string ext = osgDB::getLowerCaseFileExtension(file);
+		if (ext != "3mxa") return ReadResult::FILE_NOT_HANDLED;
+		if (status != READ)
+		{
+			OSG_WARN << "Archive " << file << " can only be read, .3mxa archives are created by the 3mxpack tool." << std::endl;
+			return ReadResult::FILE_NOT_HANDLED;
+		}
+
+		osg::ref_ptr<Archive3MX> archive = getArchive(file, options);
+		if (!archive.valid()) return ReadResult::ERROR_IN_READING_FILE;
+		return archive.get();
+	}
+
+	virtual WriteResult writeNode(const osg::Node& node, const std::string& fileName, const osgDB::ReaderWriter::Options* options) const
+	{
+		std::string ext = osgDB::getLowerCaseFileExtension(fileName);
+		if (!acceptsExtension(ext)) return WriteResult::FILE_NOT_HANDLED;
+
+		OSG_INFO << "Writing file " << fileName << std::endl;
+
+		Writer3MXB writer(options);
+		if (!writer.write(node, fileName))
+		{
+			OSG_FATAL << "Writing file " << fileName << " failed!" << std::endl;
+			return WriteResult::ERROR_IN_WRITING_FILE;
+		}
+		return WriteResult::FILE_SAVED;
+	}
+
+private:
+	// Opens a .3mxa archive, or gets it from the archive cache of the registry.
+	// Archives are always cached, as opening one reads its whole index.
+	osg::ref_ptr<Archive3MX> getArchive(const std::string& archiveName, const osgDB::ReaderWriter::Options* options) const
+	{
+		osg::ref_ptr<Archive3MX> archive = dynamic_cast<Archive3MX*>(osgDB::Registry::instance()->getFromArchiveCache(archiveName));
+		if (archive.valid()) return archive;
+
+		std::string fileName = osgDB::findDataFile(archiveName, options);
+		if (fileName.empty())
+		{
+			OSG_FATAL << "Reading archive " << archiveName << " failed! File not found." << std::endl;
+			return nullptr;
+		}
+
+		OSG_INFO << "Opening archive " << fileName << std::endl;
+
+		ReadOptions3MX readOptions(options);
+		archive = new Archive3MX;
+		if (!archive->open(fileName, readOptions.useArchiveMmap)) return nullptr;
+		osgDB::Registry::instance()->addToArchiveCache(archiveName, archive.get());
+		return archive;
+	}
+
+	ReadResult read3MX(const std::string& file, const osgDB::ReaderWriter::Options* options) const
+	{
+		std::string fileName_3mx;
+		std::string file_3mx;
+		std::string archiveName, entryName;
+		if (Archive3MX::splitPath(file, archiveName, entryName))
+		{
+			osg::ref_ptr<Archive3MX> archive = getArchive(archiveName, options);
+			Archive3MX::Entry entry;
+			if (!archive.valid() || !archive->readEntry(entryName, entry)) return ReadResult::FILE_NOT_FOUND;
+
+			fileName_3mx = file;
+			file_3mx.assign(entry.data, entry.size);
+			OSG_INFO << "Reading file " << fileName_3mx << std::endl;
+		}
+		else
+		{
+			fileName_3mx = osgDB::findDataFile(file, options);
 			if (fileName_3mx.empty()) return ReadResult::FILE_NOT_FOUND;
 
 			OSG_INFO << "Reading file " << fileName_3mx << std::endl;
@@ -251,100 +1201,253 @@ public:
 			inFile_3mx.seekg(0, std::ios::end);
 			std::streampos pos = inFile_3mx.tellg();
 			const int len = pos;
-			inFile_3mx.seekg(0, 0);
+			inFile_3mx.seekg(0, std::ios::beg);
 
 			// read file
-			neb::CJsonObject oJson_3mx;
+			file_3mx.resize(len);
+			inFile_3mx.read(&file_3mx[0], len);
+			if (inFile_3mx.gcount() != len)
 			{
-				// read file
-				std::string file_3mx(len, '\0');
-				inFile_3mx.read(&file_3mx[0], len);
+				OSG_FATAL << "Reading file " << fileName_3mx << " failed! Invalid file." << std::endl;
+				return ReadResult::ERROR_IN_READING_FILE;
+			}
+		}
+
+		// layer roots are relative to the .3mx file
+		return parse3MX(file_3mx, fileName_3mx, file.substr(0, file.find_last_of("/\\") + 1), options);
+	}
+
+	ReadResult parse3MX(const std::string& file_3mx, const std::string& fileName_3mx, const std::string& rootDir, const osgDB::ReaderWriter::Options* options) const
+	{
+		// parse file
+		neb::CJsonObject oJson_3mx;
+		if (!oJson_3mx.Parse(file_3mx))
+		{
+			OSG_FATAL << "Reading file " << fileName_3mx << " failed! Invalid file." << std::endl;
+			return ReadResult::ERROR_IN_READING_FILE;
+		}
 
-				// parse file
-				if (inFile_3mx.gcount() != len || !oJson_3mx.Parse(file_3mx))
+		// layers
+		int layersNum = oJson_3mx["layers"].GetArraySize();
+		if (!layersNum)
+		{
+			OSG_FATAL << "Reading file " << fileName_3mx << " failed! No layer." << std::endl;
+			return ReadResult::ERROR_IN_READING_FILE;
+		}
+
+		// root .3mxb of every layer, relative to the .3mx file
+		std::vector<std::string> layerRoots(layersNum);
+		for (int i = 0; i < layersNum; ++i)
+		{
+			std::string relativePath = "";
+			oJson_3mx["layers"][i].Get("root", relativePath);
+			layerRoots[i] = rootDir + relativePath;
+		}
+
+		// read the layer roots concurrently, on at most one thread per core
+		// including this one; a failure, even thrown, only fails its layer
+		std::vector<ReadResult> layerResults(layersNum);
+		std::atomic<int> nextLayer(0);
+		auto readLayers = [this, options, layersNum, &nextLayer, &layerRoots, &layerResults]()
+		{
+			for (int i = nextLayer++; i < layersNum; i = nextLayer++)
+			{
+				try
+				{
+					layerResults[i] = read3MXB(layerRoots[i], options);
+				}
+				catch (const std::exception& e)
 				{
-					OSG_FATAL << "Reading file " << fileName_3mx << " failed! Invalid file." << std::endl;
-					return ReadResult::ERROR_IN_READING_FILE;
+					layerResults[i] = ReadResult(std::string("Reading layer failed: ") + e.what());
+				}
+				catch (...)
+				{
+					layerResults[i] = ReadResult(std::string("Reading layer failed: unknown exception"));
 				}
 			}
+		};
+		unsigned int threadsNum = std::min((unsigned int)layersNum, std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<std::thread> layerThreads;
+		for (unsigned int i = 1; i < threadsNum; ++i)
+		{
+			try
+			{
+				layerThreads.push_back(std::thread(readLayers));
+			}
+			catch (const std::system_error&)
+			{
+				// fewer threads, the remaining layers are read by the others
+				break;
+			}
+		}
+		readLayers();
+		for (auto& layerThread : layerThreads)
+		{
+			layerThread.join();
+		}
 
-			// root path
-			// ----------multiple layers-----------
-			//int nodesNum2 = oJson_3mx["layers"].GetArraySize();
-			//for (int i = 0; i < nodesNum2; ++i)
-			//{
-			//	oJson_3mx["layers"][i].Get("root", filePath);
-			//}
-			//-------------------------
-			std::string relativePath = "";
-			oJson_3mx["layers"][0].Get("root", relativePath);
-			if (!oJson_3mx["layers"][0].IsNull("offset") && !oJson_3mx["layers"][0]["offset"].IsEmpty())
+		osg::ref_ptr<osg::Group> group = new osg::Group;
+		for (int i = 0; i < layersNum; ++i)
+		{
+			if (!layerResults[i].validNode())
+			{
+				OSG_WARN << "Reading layer " << i << " of file " << fileName_3mx << " failed." << (layerResults[i].message().empty() ? "" : " ") << layerResults[i].message() << std::endl;
+				continue;
+			}
+
+			osg::ref_ptr<osg::Node> layer = layerResults[i].getNode();
+			if (!oJson_3mx["layers"][i].IsNull("offset") && !oJson_3mx["layers"][i]["offset"].IsEmpty())
 			{
 				osg::Vec3d offset;
 				for (int j = 0; j < 3; ++j)
 				{
-					oJson_3mx["layers"][0]["offset"].Get(j, offset[j]);
+					oJson_3mx["layers"][i]["offset"].Get(j, offset[j]);
 				}
 
-				matrixTransform = new osg::MatrixTransform();
+				osg::ref_ptr<osg::MatrixTransform> matrixTransform = new osg::MatrixTransform();
 				matrixTransform->setMatrix(osg::Matrix::translate(offset.x(), offset.y(), offset.z()));
+				matrixTransform->addChild(layer);
+				layer = matrixTransform;
+			}
+
+			if (layersNum == 1)
+			{
+				return layer.get();
 			}
+			group->addChild(layer);
+		}
 
-			int posPath = 0;
-			posPath = filePath.find_last_of("/\\") + 1;
-			filePath = filePath.substr(0, posPath) + relativePath;
+		if (!group->getNumChildren())
+		{
+			return layerResults[0];
 		}
-		//-------3mx end-----------
+		group->setName(osgDB::getNameLessExtension(fileName_3mx));
+		return group.get();
+	}
 
-		std::string ext = osgDB::getLowerCaseFileExtension(filePath);
-		if (!acceptsExtension(ext)) return ReadResult::FILE_NOT_HANDLED;
+	// Name of the plugin string data marking the database options of the
+	// PagedLODs created by this reader: their file names are complete paths,
+	// which are read without searching the data file paths.
+	static const char* resolvedPathsName() { return "3mx_ResolvedPaths"; }
 
-		std::string fileName = osgDB::findDataFile(filePath, options);
-		if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+	// Copy of the options marked as resolved, for the children of a tile.
+	osg::ref_ptr<osgDB::ReaderWriter::Options> resolvedOptions(const osgDB::ReaderWriter::Options* options) const
+	{
+		osg::ref_ptr<osgDB::ReaderWriter::Options> childOptions = options ? options->cloneOptions() : new osgDB::ReaderWriter::Options;
+		childOptions->setPluginStringData(resolvedPathsName(), "true");
+		return childOptions;
+	}
 
-		OSG_INFO << "Reading file " << fileName << std::endl;
+	ReadResult read3MXB(const std::string& filePath, const osgDB::ReaderWriter::Options* options) const
+	{
+		bool resolvedPath = options && !options->getPluginStringData(resolvedPathsName()).empty();
 
-		std::ifstream inFile(fileName, std::ios::in | std::ios::binary);
-		if (!inFile) {
-			OSG_FATAL << "Reading file " << fileName << " failed! Can NOT open file." << std::endl;
-			return ReadResult::ERROR_IN_READING_FILE;
+		// per-tile statistics, only when requested
+		LoadStats3MX* stats = LoadStats3MX::get(options);
+		TileStats3MX tileStats;
+		TileStats3MX* tile = stats ? &tileStats : nullptr;
+		StageTimer3MX timer(tile);
+
+		// the children of the tile are opened without search
+		osg::ref_ptr<osgDB::ReaderWriter::Options> childOptions = const_cast<osgDB::ReaderWriter::Options*>(options);
+		if (!resolvedPath) childOptions = resolvedOptions(options);
+
+		ReadResult result;
+		std::string fileName;
+		std::string archiveName, entryName;
+		if (Archive3MX::splitPath(filePath, archiveName, entryName))
+		{
+			// tile of a packed dataset, read from memory
+			osg::ref_ptr<Archive3MX> archive = getArchive(archiveName, options);
+			Archive3MX::Entry entry;
+			if (!archive.valid() || !archive->readEntry(entryName, entry)) return ReadResult::FILE_NOT_FOUND;
+
+			fileName = filePath;
+			OSG_INFO << "Reading file " << fileName << std::endl;
+
+			result = read3MXB(entry.data, entry.size, fileName, osgDB::getFilePath(fileName), options, childOptions.get(), timer, tile);
 		}
-		
-		// read magic number
+		else
 		{
-			const int magicNumberLen = 5;
-			std::string magicNumber(magicNumberLen, '\0');
-			inFile.read(&magicNumber[0], magicNumberLen);
-			if (inFile.gcount() != magicNumberLen || magicNumber != "3MXBO")
+			if (resolvedPath)
+			{
+				fileName = filePath;
+			}
+			else
+			{
+				// only root tiles are searched, their children get absolute paths
+				fileName = osgDB::findDataFile(filePath, options);
+				if (fileName.empty()) return ReadResult::FILE_NOT_FOUND;
+				fileName = osgDB::getRealPath(fileName);
+			}
+
+			OSG_INFO << "Reading file " << fileName << std::endl;
+
+			std::ifstream inFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+			if (!inFile) {
+				if (resolvedPath) return ReadResult::FILE_NOT_FOUND;
+				OSG_FATAL << "Reading file " << fileName << " failed! Can NOT open file." << std::endl;
+				return ReadResult::ERROR_IN_READING_FILE;
+			}
+
+			// read the whole tile at once
+			std::vector<char> content((size_t)inFile.tellg());
+			inFile.seekg(0, std::ios::beg);
+			if (!content.empty()) inFile.read(&content[0], content.size());
+			if ((size_t)inFile.gcount() != content.size())
 			{
-				OSG_FATAL << "Reading file " << fileName << " failed! Invalid magic number." << std::endl;
+				OSG_FATAL << "Reading file " << fileName << " failed! Can NOT read file." << std::endl;
 				return ReadResult::ERROR_IN_READING_FILE;
 			}
+			timer.lap(TileStats3MX::FILE_IO);
+			result = read3MXB(content.data(), content.size(), fileName, osgDB::getFilePath(fileName), options, childOptions.get(), timer, tile);
+		}
+
+		if (stats && result.validNode())
+		{
+			tileStats.fileName = fileName;
+			stats->add(tileStats);
+		}
+		return result;
+	}
+
+	// Parses the .3mxb bytes data[0, size). The child tiles of its PagedLODs
+	// are paged from childDir, with childOptions as database options.
+	ReadResult read3MXB(const char* data, size_t size, const std::string& fileName, const std::string& childDir,
+		const osgDB::ReaderWriter::Options* options, osgDB::ReaderWriter::Options* childOptions, StageTimer3MX& timer, TileStats3MX* tile) const
+	{
+		if (tile) tile->bytes += size;
+
+		// read magic number
+		const size_t magicNumberLen = 5;
+		if (size < magicNumberLen || memcmp(data, "3MXBO", magicNumberLen) != 0)
+		{
+			OSG_FATAL << "Reading file " << fileName << " failed! Invalid magic number." << std::endl;
+			return ReadResult::ERROR_IN_READING_FILE;
 		}
 
 		// read header
 		neb::CJsonObject oJson;
+		size_t pos = magicNumberLen;
 		{
 			// read header size
-			const int headerSizeLen = 4;
+			const size_t headerSizeLen = 4;
 			uint32_t headerSize = 0;
-			inFile.read((char*)&headerSize, headerSizeLen);
-			if (inFile.gcount() != headerSizeLen)
+			if (size - pos < headerSizeLen)
 			{
 				OSG_FATAL << "Reading file " << fileName << " failed! Invalid header size." << std::endl;
 				return ReadResult::ERROR_IN_READING_FILE;
 			}
-
-			// read header
-			std::string header(headerSize, '\0');
-			inFile.read(&header[0], headerSize);
+			memcpy(&headerSize, data + pos, headerSizeLen);
+			pos += headerSizeLen;
 
 			// parse header
-			if (inFile.gcount() != headerSize || !oJson.Parse(header))
+			if (size - pos < headerSize || !oJson.Parse(std::string(data + pos, headerSize)))
 			{
 				OSG_FATAL << "Reading file " << fileName << " failed! Invalid header." << std::endl;
 				return ReadResult::ERROR_IN_READING_FILE;
 			}
+			pos += headerSize;
 		}
 
 		// version
@@ -358,17 +1461,41 @@ public:
 			}
 		}
 
+		timer.lap(TileStats3MX::HEADER_PARSE);
+
 		// resources
+		ReadOptions3MX readOptions(options);
 		std::map<std::string, Resource3MXB> mapResource3MXB;
-		if (!readResources(inFile, oJson["resources"], mapResource3MXB))
+		if (!readResources(data, size, pos, oJson["resources"], mapResource3MXB, readOptions, tile))
 		{
 			OSG_FATAL << "Reading file " << fileName << " failed! Invalid resources." << std::endl;
 			return ReadResult::ERROR_IN_READING_FILE;
 		}
+		timer.restart();
+
+		// textures shared with other tiles could not be cropped to the uvs of this one
+		uint64_t croppedTexels = 0;
+		if (readOptions.cropTextures && !readOptions.shareTextures)
+		{
+			croppedTexels = cropTextures(mapResource3MXB);
+		}
+		std::string atlasId;
+		osg::ref_ptr<osg::Image> atlas;
+		int atlasTexturesNum = 0;
+		if (readOptions.atlasTextures)
+		{
+			atlasTexturesNum = atlasTextures(mapResource3MXB, atlasId, atlas);
+		}
 
 		// nodes
 		int nodesNum = oJson["nodes"].GetArraySize();
+		int mergedDrawsNum = 0;
+		unsigned int vertexCacheMisses[3] = { 0, 0, 0 };
+		std::set<osg::ref_ptr<osg::Geometry> > geometries;
+		std::map<osg::Geometry*, osg::ref_ptr<osg::MatrixTransform> > mapDequantize;
+		std::map<std::string, osg::ref_ptr<osg::StateSet> > mapStateSet;
 		osg::ref_ptr<osg::Group> group = new osg::Group;
+
 		for (int i = 0; i < nodesNum; ++i)
 		{
 			float maxScreenDiameter = 0.f;
@@ -382,29 +1509,83 @@ public:
 				oJson["nodes"][i]["bbMax"].Get(j, bbMax[j]);
 			}
 
-			osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+			std::vector<Resource3MXB> nodeGeometries;
 			int nodeResourcesNum = oJson["nodes"][i]["resources"].GetArraySize();
 			for (int j = 0; j < nodeResourcesNum; ++j)
 			{
 				std::string resourceId;
 				oJson["nodes"][i]["resources"].Get(j, resourceId);
 				auto& resource3MXB = mapResource3MXB[resourceId];
-				if (resource3MXB.type == "geometryBuffer")
+				if (resource3MXB.type == "geometryBuffer" && resource3MXB.geometry.valid())
 				{
-					geode->addDrawable(resource3MXB.geometry);
-					if (resource3MXB.textureId.size())
+					nodeGeometries.push_back(resource3MXB);
+				}
+			}
+			if ((readOptions.mergeGeometries || readOptions.atlasTextures) && nodeGeometries.size() > 1)
+			{
+				mergedDrawsNum += mergeNodeGeometries(nodeGeometries);
+			}
+
+			osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+			osg::ref_ptr<osg::Group> content = geode;
+			for (auto& resource3MXB : nodeGeometries)
+			{
+				if (geometries.insert(resource3MXB.geometry).second && readOptions.optimizeVertexCache && isTriangleMesh(resource3MXB.geometry))
+				{
+					optimizeVertexCache(resource3MXB.geometry, vertexCacheMisses);
+				}
+
+				if (resource3MXB.textureId.size() && readOptions.atlasTextures && !readOptions.quantizeVertices)
+				{
+					// a single state set per texture, quantized geometries have their own TexMat
+					osg::ref_ptr<osg::StateSet>& stateSet = mapStateSet[resource3MXB.textureId];
+					if (!stateSet.valid())
+					{
+						stateSet = new osg::StateSet;
+						stateSet->setTextureAttributeAndModes(0, mapResource3MXB[resource3MXB.textureId].texture, osg::StateAttribute::ON);
+					}
+					resource3MXB.geometry->setStateSet(stateSet);
+				}
+				else if (resource3MXB.textureId.size())
+				{
+					resource3MXB.geometry->getOrCreateStateSet()->setTextureAttributeAndModes(0, mapResource3MXB[resource3MXB.textureId].texture, osg::StateAttribute::ON);
+				}
+
+				osg::ref_ptr<osg::MatrixTransform>& dequantize = mapDequantize[resource3MXB.geometry];
+				osg::Matrix dequantizeMatrix;
+				if (readOptions.quantizeVertices && !dequantize.valid() && quantizeGeometry(resource3MXB.geometry, dequantizeMatrix))
+				{
+					osg::ref_ptr<osg::Geode> quantizedGeode = new osg::Geode;
+					quantizedGeode->addDrawable(resource3MXB.geometry);
+					dequantize = new osg::MatrixTransform(dequantizeMatrix);
+					dequantize->addChild(quantizedGeode);
+				}
+
+				if (dequantize.valid())
+				{
+					if (content.get() == geode.get())
 					{
-						resource3MXB.geometry->getOrCreateStateSet()->setTextureAttributeAndModes(0, mapResource3MXB[resource3MXB.textureId].texture, osg::StateAttribute::ON);
+						content = new osg::Group;
+						content->addChild(geode);
 					}
+					content->addChild(dequantize);
+				}
+				else
+				{
+					geode->addDrawable(resource3MXB.geometry);
 				}
 			}
-			geode->setInitialBound(osg::BoundingBox(bbMin, bbMax));
+			if (content.get() != geode.get() && !geode->getNumDrawables())
+			{
+				content->removeChild(geode);
+			}
+			content->setInitialBound(osg::BoundingBox(bbMin, bbMax));
 
 			int childNum = oJson["nodes"][i]["children"].GetArraySize();
 			if (!childNum)
 			{
 				// add to group
-				group->addChild(geode);
+				group->addChild(content);
 			}
 			else
 			{
@@ -415,17 +1596,20 @@ public:
 				pagedLOD->setCenter((bbMin + bbMax) / 2.0f);
 				pagedLOD->setRadius(sqrt((bbMax - bbMin).length2() * 0.25f));
 
+				// child tiles share the database path and options
+				pagedLOD->setDatabasePath(childDir);
+				pagedLOD->setDatabaseOptions(childOptions);
+
 				if (nodeResourcesNum)
 				{
-					pagedLOD->addChild(geode, 0, maxScreenDiameter);
+					pagedLOD->addChild(content, 0, maxScreenDiameter);
 
 					// children
 					for (int j = 0; j < childNum; ++j)
 					{
 						std::string childPath;
 						oJson["nodes"][i]["children"].Get(j, childPath);
-						std::string childName = osgDB::getFilePath(fileName) + "/" + childPath;
-						pagedLOD->setFileName(j + 1, childName);
+						pagedLOD->setFileName(j + 1, childPath);
 						pagedLOD->setRange(j + 1, maxScreenDiameter, 1e30);
 					}
 				}
@@ -436,8 +1620,7 @@ public:
 					{
 						std::string childPath;
 						oJson["nodes"][i]["children"].Get(j, childPath);
-						std::string childName = osgDB::getFilePath(fileName) + "/" + childPath;
-						pagedLOD->setFileName(j, childName);
+						pagedLOD->setFileName(j, childPath);
 						pagedLOD->setRange(j, maxScreenDiameter, 1e30);
 					}
 				}
@@ -447,16 +1630,33 @@ public:
 			}
 		}
 
-		group->setName(osgDB::getNameLessExtension(fileName));
-		if (matrixTransform.get())
+		for (auto& geometry : geometries)
 		{
-			matrixTransform->addChild(group);
-			return matrixTransform;
+			setupBufferObjects(geometry, readOptions);
 		}
-		else
+		if (vertexCacheMisses[2])
+		{
+			OSG_INFO << "Optimized vertex cache of file " << fileName << ", ACMR "
+				<< (double)vertexCacheMisses[0] / vertexCacheMisses[2] << " -> "
+				<< (double)vertexCacheMisses[1] / vertexCacheMisses[2] << std::endl;
+		}
+		if (croppedTexels)
+		{
+			OSG_INFO << "Cropped textures of file " << fileName << ", " << croppedTexels << " texels removed." << std::endl;
+		}
+		if (atlasTexturesNum)
 		{
-			return group;
+			OSG_INFO << "Packed " << atlasTexturesNum << " textures of file " << fileName << " into a "
+				<< atlas->s() << "x" << atlas->t() << " atlas." << std::endl;
 		}
+		if (mergedDrawsNum)
+		{
+			OSG_INFO << "Merged geometries of file " << fileName << ", " << mergedDrawsNum << " draws removed." << std::endl;
+		}
+
+		group->setName(osgDB::getNameLessExtension(fileName));
+		timer.lap(TileStats3MX::GRAPH_BUILD);
+		return group.get();
 	}
 };
 
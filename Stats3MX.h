@@ -0,0 +1,158 @@
+#ifndef STATS_3MX_H
+#define STATS_3MX_H
+
+#include <osgDB/Options>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Statistics of reading a single 3mxb tile.
+struct TileStats3MX
+{
+	enum Stage
+	{
+		FILE_IO,        // reading the tile bytes
+		HEADER_PARSE,   // parsing the 3mxb JSON header
+		JPEG_DECODE,    // decoding the textures
+		CTM_LZMA,       // LZMA decompression of the ctm meshes
+		CTM_RESTORE,    // the rest of mesh decoding (MG2 restore, checks, fmc decode)
+		GRAPH_BUILD,    // building the OSG scene graph, including mesh processing
+		NUM_STAGES
+	};
+
+	std::string fileName;
+	double seconds[NUM_STAGES];
+	uint64_t bytes;         // bytes read from the tile file
+	uint64_t triangles;
+	uint64_t points;        // vertices of xyz point clouds
+	uint64_t texels;
+	uint64_t sharedTextures; // textures shared with another tile, see shareTextures
+
+	TileStats3MX() : bytes(0), triangles(0), points(0), texels(0), sharedTextures(0)
+	{
+		for (int i = 0; i < NUM_STAGES; ++i) seconds[i] = 0.0;
+	}
+
+	static const char* stageName(Stage stage)
+	{
+		static const char* names[NUM_STAGES] = { "file I/O", "header JSON parse", "JPEG decode", "CTM LZMA", "mesh restore", "OSG graph build" };
+		return names[stage];
+	}
+};
+
+// Called for every tile read successfully, from the thread that read it.
+class TileStatsCallback3MX
+{
+public:
+	virtual ~TileStatsCallback3MX() {}
+	virtual void tileRead(const TileStats3MX& tile) = 0;
+};
+
+// Load statistics of the 3mx reader, summed over all tiles read with the same
+// options (and over all threads reading them). Collected only when an instance
+// is passed to the reader as plugin data:
+//     options->setPluginData(LoadStats3MX::pluginDataName(), &stats);
+// A single instance shared by all options gives process-wide counters.
+struct LoadStats3MX
+{
+	std::atomic<uint64_t> nanoseconds[TileStats3MX::NUM_STAGES];
+	std::atomic<uint64_t> tiles;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> triangles;
+	std::atomic<uint64_t> points;
+	std::atomic<uint64_t> texels;
+	std::atomic<uint64_t> sharedTextures;
+
+	// optional per-tile callback, not owned
+	TileStatsCallback3MX* callback;
+
+	LoadStats3MX() : callback(nullptr) { reset(); }
+
+	void reset()
+	{
+		for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i) nanoseconds[i] = 0;
+		tiles = 0;
+		bytes = 0;
+		triangles = 0;
+		points = 0;
+		texels = 0;
+		sharedTextures = 0;
+	}
+
+	void add(const TileStats3MX& tile)
+	{
+		for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i) nanoseconds[i] += (uint64_t)(tile.seconds[i] * 1e9);
+		++tiles;
+		bytes += tile.bytes;
+		triangles += tile.triangles;
+		points += tile.points;
+		texels += tile.texels;
+		sharedTextures += tile.sharedTextures;
+		if (callback) callback->tileRead(tile);
+	}
+
+	double seconds(TileStats3MX::Stage stage) const
+	{
+		return nanoseconds[stage] * 1e-9;
+	}
+
+	void dump(std::ostream& out) const
+	{
+		out << "tiles " << tiles << ", " << bytes << " bytes, " << triangles << " triangles, "
+			<< points << " points, " << texels << " texels, " << sharedTextures << " shared textures" << std::endl;
+		for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i)
+		{
+			out << TileStats3MX::stageName((TileStats3MX::Stage)i) << ": " << seconds((TileStats3MX::Stage)i) * 1e3 << " ms" << std::endl;
+		}
+	}
+
+	static const char* pluginDataName() { return "3mx_LoadStats"; }
+
+	static LoadStats3MX* get(const osgDB::Options* options)
+	{
+		return options ? (LoadStats3MX*)options->getPluginData(pluginDataName()) : nullptr;
+	}
+};
+
+// Adds the time elapsed since construction (or the last lap) to a stage of
+// the tile stats, if any.
+class StageTimer3MX
+{
+public:
+	StageTimer3MX(TileStats3MX* tile) : _tile(tile)
+	{
+		if (_tile) _start = std::chrono::steady_clock::now();
+	}
+
+	// Adds the elapsed time to stage and restarts the timer.
+	void lap(TileStats3MX::Stage stage)
+	{
+		split(stage, stage, 0.0);
+	}
+
+	// Same as lap(), but partSeconds of the elapsed time go to part instead.
+	void split(TileStats3MX::Stage stage, TileStats3MX::Stage part, double partSeconds)
+	{
+		if (!_tile) return;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(now - _start).count();
+		_tile->seconds[part] += partSeconds;
+		_tile->seconds[stage] += seconds > partSeconds ? seconds - partSeconds : 0.0;
+		_start = now;
+	}
+
+	// Restarts the timer, dropping the elapsed time.
+	void restart()
+	{
+		if (_tile) _start = std::chrono::steady_clock::now();
+	}
+
+private:
+	TileStats3MX* _tile;
+	std::chrono::steady_clock::time_point _start;
+};
+
+#endif // STATS_3MX_H
@@ -0,0 +1,46 @@
+#ifndef STREAM_3MX_H
+#define STREAM_3MX_H
+
+#include <stddef.h>
+#include <streambuf>
+
+// Read-only std::streambuf over a memory block. A .3mxb tile already in
+// memory is read without a copy by passing a stream over it to the reader:
+//     MemoryStreamBuf3MX buffer(data, size);
+//     std::istream stream(&buffer);
+//     options->setDatabasePath(tileDirectory);
+//     readerWriter->readNode(stream, options);
+// The reader parses the block in place, so it must stay valid during the read.
+class MemoryStreamBuf3MX : public std::streambuf
+{
+public:
+	MemoryStreamBuf3MX(const char* data, size_t size)
+	{
+		char* begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+
+	const char* data() const { return eback(); }
+	size_t size() const { return egptr() - eback(); }
+
+protected:
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in)
+	{
+		if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+		off_type pos = off;
+		if (dir == std::ios_base::cur) pos += gptr() - eback();
+		else if (dir == std::ios_base::end) pos += egptr() - eback();
+		if (pos < 0 || pos > egptr() - eback()) return pos_type(off_type(-1));
+
+		setg(eback(), eback() + pos, egptr());
+		return pos_type(pos);
+	}
+
+	virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in)
+	{
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+};
+
+#endif // STREAM_3MX_H
@@ -0,0 +1,100 @@
+#include "TextureRegistry3MX.h"
+
+#include <string.h>
+
+namespace
+{
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+	inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+	inline uint64_t fmix64(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+}
+
+TextureRegistry3MX& TextureRegistry3MX::instance()
+{
+	static TextureRegistry3MX registry;
+	return registry;
+}
+
+TextureRegistry3MX::Key TextureRegistry3MX::makeKey(const char* data, size_t size)
+{
+	// four independent lanes of 8 bytes, so that the multiplications overlap
+	uint64_t lanes[4] = { prime1, prime2, ~prime1, ~prime2 };
+	size_t pos = 0;
+	for (; pos + 32 <= size; pos += 32)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			uint64_t word;
+			memcpy(&word, data + pos + i * 8, 8);
+			lanes[i] = rotl64(lanes[i] + word * prime2, 31) * prime1;
+		}
+	}
+
+	uint64_t h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18) + size;
+	for (; pos + 8 <= size; pos += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + pos, 8);
+		h = rotl64(h ^ (word * prime2), 27) * prime1;
+	}
+	for (; pos < size; ++pos)
+	{
+		h = rotl64(h ^ ((unsigned char)data[pos] * prime1), 11) * prime2;
+	}
+
+	Key key;
+	key.hash = fmix64(h);
+	key.size = size;
+	return key;
+}
+
+osg::ref_ptr<osg::Texture2D> TextureRegistry3MX::find(const Key& key)
+{
+	osg::ref_ptr<osg::Texture2D> texture;
+	std::lock_guard<std::mutex> lock(_mutex);
+	TextureMap::iterator it = _textures.find(key);
+	if (it != _textures.end() && !it->second.lock(texture)) _textures.erase(it);
+	return texture;
+}
+
+osg::ref_ptr<osg::Texture2D> TextureRegistry3MX::add(const Key& key, osg::Texture2D* texture)
+{
+	osg::ref_ptr<osg::Texture2D> resident;
+	std::lock_guard<std::mutex> lock(_mutex);
+	osg::observer_ptr<osg::Texture2D>& entry = _textures[key];
+	if (entry.lock(resident)) return resident;
+
+	entry = texture;
+	if (_textures.size() >= _purgeSize) purge();
+	return texture;
+}
+
+size_t TextureRegistry3MX::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _textures.size();
+}
+
+void TextureRegistry3MX::purge()
+{
+	for (TextureMap::iterator it = _textures.begin(); it != _textures.end();)
+	{
+		if (!it->second.valid()) it = _textures.erase(it);
+		else ++it;
+	}
+
+	// purge again when the live entries have doubled, so that adding stays
+	// amortized constant time
+	_purgeSize = _textures.size() * 2 > 64 ? _textures.size() * 2 : 64;
+}
@@ -0,0 +1,97 @@
+#ifndef TEXTURE_REGISTRY_3MX_H
+#define TEXTURE_REGISTRY_3MX_H
+
+#include <osg/Texture2D>
+#include <osg/observer_ptr>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+
+// Process-wide registry of the textures read from 3mxb tiles, keyed by a hash
+// and the size of their encoded buffer, so that the identical texture buffers
+// of neighbouring tiles share a single Texture2D instead of being decoded and
+// uploaded again. It only holds weak references: a texture leaves it when the
+// last tile using it is paged out. Used by the reader with the shareTextures
+// option.
+class TextureRegistry3MX
+{
+public:
+	struct Key
+	{
+		uint64_t hash = 0;
+		uint64_t size = 0;
+
+		bool operator==(const Key& other) const { return hash == other.hash && size == other.size; }
+	};
+
+	struct Stats
+	{
+		std::atomic<uint64_t> lookups;
+		std::atomic<uint64_t> hits;
+		std::atomic<uint64_t> bytesSaved;   // encoded texture bytes not decoded again
+		std::atomic<uint64_t> texelsSaved;  // texels not uploaded again
+
+		Stats() { reset(); }
+
+		void reset()
+		{
+			lookups = 0;
+			hits = 0;
+			bytesSaved = 0;
+			texelsSaved = 0;
+		}
+
+		void dump(std::ostream& out) const
+		{
+			out << "shared textures: " << hits << " of " << lookups << " lookups ("
+				<< (lookups ? 100.0 * hits / lookups : 0.0) << "%), "
+				<< bytesSaved << " encoded bytes, " << texelsSaved << " texels saved" << std::endl;
+		}
+	};
+
+	static TextureRegistry3MX& instance();
+
+	// Hash of an encoded texture buffer; not cryptographic, buffers with the
+	// same key are assumed identical.
+	static Key makeKey(const char* data, size_t size);
+
+	// Returns the resident texture of key, if any.
+	osg::ref_ptr<osg::Texture2D> find(const Key& key);
+
+	// Registers the texture of key and returns it, or the texture registered
+	// meanwhile by another thread reading the same buffer.
+	osg::ref_ptr<osg::Texture2D> add(const Key& key, osg::Texture2D* texture);
+
+	// Number of registered textures, including the ones released but not yet
+	// purged.
+	size_t size() const;
+
+	Stats& stats() { return _stats; }
+	const Stats& stats() const { return _stats; }
+
+private:
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const { return (size_t)key.hash; }
+	};
+
+	typedef std::unordered_map<Key, osg::observer_ptr<osg::Texture2D>, KeyHash> TextureMap;
+
+	TextureRegistry3MX() : _purgeSize(64) {}
+	TextureRegistry3MX(const TextureRegistry3MX&);
+	TextureRegistry3MX& operator=(const TextureRegistry3MX&);
+
+	// Removes the entries of released textures, with the mutex locked.
+	void purge();
+
+	mutable std::mutex _mutex;
+	TextureMap _textures;
+	size_t _purgeSize;
+	Stats _stats;
+};
+
+#endif // TEXTURE_REGISTRY_3MX_H
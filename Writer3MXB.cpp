@@ -0,0 +1,765 @@
+#include "Writer3MXB.h"
+
+#include <osg/Notify>
+#include <osg/PagedLOD>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/TexMat>
+#include <osg/Texture2D>
+#include <osg/Transform>
+#include <osg/TriangleIndexFunctor>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+
+#include <float.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+#include "CJsonObject.hpp"
+#include "openctm.h"
+#include "MeshCodec3MX.h"
+
+static CTMuint CTMCALL _ctmStringWrite(const void * aBuf /*in buf*/, CTMuint aCount,
+	void * aUserData /*string*/)
+{
+	((std::string*)aUserData)->append((const char*)aBuf, aCount);
+	return aCount;
+}
+
+WriteOptions3MX::WriteOptions3MX(const osgDB::ReaderWriter::Options* options)
+{
+	if (!options) return;
+
+	std::istringstream iss(options->getOptionString());
+	std::string opt;
+	while (iss >> opt)
+	{
+		std::string::size_type pos = opt.find('=');
+		if (pos == std::string::npos) continue;
+
+		std::string key = opt.substr(0, pos);
+		std::istringstream value(opt.substr(pos + 1));
+		if (key == "threads") value >> threads;
+		else if (key == "ctmVertexPrecisionRel") value >> ctmVertexPrecisionRel;
+		else if (key == "ctmThreads") value >> ctmThreads;
+		else if (key == "ctmPreset")
+		{
+			value >> ctmPreset;
+			if (ctmPreset != "fastEncode" && ctmPreset != "maxRatio")
+			{
+				OSG_WARN << "3mxb writer: unknown ctmPreset " << ctmPreset << ", using the default compression level." << std::endl;
+				ctmPreset.clear();
+			}
+		}
+		else if (key == "meshFormat")
+		{
+			value >> meshFormat;
+			if (meshFormat != "ctm" && meshFormat != "fmc")
+			{
+				OSG_WARN << "3mxb writer: unknown meshFormat " << meshFormat << ", writing ctm meshes." << std::endl;
+				meshFormat = "ctm";
+			}
+		}
+		else if (key == "jpegQuality") value >> jpegQuality;
+	}
+}
+
+namespace
+{
+	struct GeometryEntry3MXB
+	{
+		osg::ref_ptr<const osg::Geometry> geometry;
+		osg::Matrix matrix;
+		osg::ref_ptr<osg::Image> image;
+	};
+
+	struct Node3MXB
+	{
+		std::string id;
+		osg::BoundingBox bb;
+		float maxScreenDiameter = 0.f;
+		std::vector<std::string> children;
+		std::vector<GeometryEntry3MXB> geometries;
+	};
+
+	struct TriangleIndexCollector
+	{
+		std::vector<CTMuint>* indices = nullptr;
+
+		void operator()(unsigned int i1, unsigned int i2, unsigned int i3)
+		{
+			if (i1 == i2 || i2 == i3 || i1 == i3) return;
+			indices->push_back(i1);
+			indices->push_back(i2);
+			indices->push_back(i3);
+		}
+	};
+
+	osg::Image* getTextureImage(const osg::StateSet* stateSet)
+	{
+		if (!stateSet) return nullptr;
+		const osg::Texture2D* texture = dynamic_cast<const osg::Texture2D*>(stateSet->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+		return texture ? const_cast<osg::Image*>(texture->getImage()) : nullptr;
+	}
+
+	void addToJsonArray(neb::CJsonObject& oJson, const std::string& key, const osg::Vec3& v)
+	{
+		oJson.AddEmptySubArray(key);
+		for (int j = 0; j < 3; ++j)
+		{
+			oJson[key].Add(v[j]);
+		}
+	}
+
+	// Float vertices of an array, Vec3sArray ones as stored: they are
+	// dequantized by the transforms above them, which are part of the matrix.
+	bool getVertices(const osg::Array* array, std::vector<osg::Vec3>& vertices)
+	{
+		if (const osg::Vec3Array* vec3Array = dynamic_cast<const osg::Vec3Array*>(array))
+		{
+			vertices.assign(vec3Array->begin(), vec3Array->end());
+		}
+		else if (const osg::Vec3sArray* vec3sArray = dynamic_cast<const osg::Vec3sArray*>(array))
+		{
+			vertices.resize(vec3sArray->size());
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				const osg::Vec3s& v = (*vec3sArray)[i];
+				vertices[i] = osg::Vec3(v.x(), v.y(), v.z());
+			}
+		}
+		else return false;
+		return true;
+	}
+
+	// Float normals of an array, including 8-bit quantized ones.
+	bool getNormals(const osg::Array* array, std::vector<osg::Vec3>& normals)
+	{
+		if (const osg::Vec3Array* vec3Array = dynamic_cast<const osg::Vec3Array*>(array))
+		{
+			normals.assign(vec3Array->begin(), vec3Array->end());
+		}
+		else if (const osg::Vec3bArray* vec3bArray = dynamic_cast<const osg::Vec3bArray*>(array))
+		{
+			normals.resize(vec3bArray->size());
+			for (size_t i = 0; i < normals.size(); ++i)
+			{
+				const osg::Vec3b& n = (*vec3bArray)[i];
+				normals[i] = osg::Vec3(n.x(), n.y(), n.z()) / 127.f;
+			}
+		}
+		else return false;
+		return true;
+	}
+
+	// Float uvs of an array, including 16-bit quantized ones, transformed by
+	// the TexMat of the geometry, if any.
+	bool getUVs(const osg::Geometry& geometry, const osg::Array* array, std::vector<osg::Vec2>& uvs)
+	{
+		if (const osg::Vec2Array* vec2Array = dynamic_cast<const osg::Vec2Array*>(array))
+		{
+			uvs.assign(vec2Array->begin(), vec2Array->end());
+		}
+		else if (const osg::Vec2sArray* vec2sArray = dynamic_cast<const osg::Vec2sArray*>(array))
+		{
+			uvs.resize(vec2sArray->size());
+			for (size_t i = 0; i < uvs.size(); ++i)
+			{
+				const osg::Vec2s& uv = (*vec2sArray)[i];
+				uvs[i] = osg::Vec2(uv.x(), uv.y());
+			}
+		}
+		else return false;
+
+		const osg::StateSet* stateSet = geometry.getStateSet();
+		const osg::TexMat* texMat = stateSet ? dynamic_cast<const osg::TexMat*>(stateSet->getTextureAttribute(0, osg::StateAttribute::TEXMAT)) : nullptr;
+		if (texMat)
+		{
+			const osg::Matrix& matrix = texMat->getMatrix();
+			for (auto& uv : uvs)
+			{
+				osg::Vec3 transformed = osg::Vec3(uv.x(), uv.y(), 0.f) * matrix;
+				uv = osg::Vec2(transformed.x(), transformed.y());
+			}
+		}
+		return true;
+	}
+
+	// Gathers the 3mxb nodes of a tile: one per PagedLOD, plus one for the
+	// geometries outside of any PagedLOD.
+	class TileCollector : public osg::NodeVisitor
+	{
+	public:
+		TileCollector(Writer3MXB& writer, const osg::Matrix& matrix, std::vector<Writer3MXB::ChildTile>& childTiles) :
+			osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			_writer(writer),
+			_childTiles(childTiles),
+			_currentNode(-1),
+			_leafNode(-1)
+		{
+			_matrixStack.push_back(matrix);
+			_imageStack.push_back(nullptr);
+		}
+
+		std::vector<Node3MXB> nodes;
+
+		// name of a PagedLOD nested in the content of another one, which a
+		// 3mxb node could not hold
+		std::string nestedPagedLOD;
+		bool hasNestedPagedLOD = false;
+
+		virtual void apply(osg::Node& node)
+		{
+			pushStateSet(node.getStateSet());
+			traverse(node);
+			_imageStack.pop_back();
+		}
+
+		virtual void apply(osg::Transform& transform)
+		{
+			osg::Matrix matrix = _matrixStack.back();
+			transform.computeLocalToWorldMatrix(matrix, this);
+			_matrixStack.push_back(matrix);
+			pushStateSet(transform.getStateSet());
+			traverse(transform);
+			_imageStack.pop_back();
+			_matrixStack.pop_back();
+		}
+
+		virtual void apply(osg::PagedLOD& pagedLOD)
+		{
+			if (_currentNode >= 0)
+			{
+				nestedPagedLOD = pagedLOD.getName();
+				hasNestedPagedLOD = true;
+				return;
+			}
+
+			int index = (int)nodes.size();
+			nodes.push_back(Node3MXB());
+			nodes[index].id = "node" + std::to_string(index);
+
+			// bounding sphere as a box, in tile coordinates
+			const osg::BoundingSphere& bs = pagedLOD.getBound();
+			if (bs.valid())
+			{
+				const osg::Matrix& matrix = _matrixStack.back();
+				osg::Vec3 center = osg::Vec3(bs.center()) * matrix;
+				float radius = bs.radius() * (float)osg::maximum(matrix.getScale().x(), osg::maximum(matrix.getScale().y(), matrix.getScale().z()));
+				nodes[index].bb.expandBy(center - osg::Vec3(radius, radius, radius));
+				nodes[index].bb.expandBy(center + osg::Vec3(radius, radius, radius));
+			}
+
+			if (pagedLOD.getRangeMode() != osg::LOD::PIXEL_SIZE_ON_SCREEN)
+			{
+				OSG_WARN << "3mxb writer: PagedLOD " << pagedLOD.getName() << " does not use PIXEL_SIZE_ON_SCREEN, ranges are written as screen diameters." << std::endl;
+			}
+
+			pushStateSet(pagedLOD.getStateSet());
+			int parentNode = _currentNode;
+			_currentNode = index;
+			float maxScreenDiameter = FLT_MAX;
+			for (unsigned int i = 0; i < pagedLOD.getNumRanges(); ++i)
+			{
+				if (i < pagedLOD.getNumFileNames() && !pagedLOD.getFileName(i).empty())
+				{
+					Writer3MXB::ChildTile childTile;
+					childTile.sourceFileName = pagedLOD.getDatabasePath() + pagedLOD.getFileName(i);
+					childTile.matrix = _matrixStack.back();
+					bool isNew = false;
+					childTile.tileName = _writer.tileName(childTile.sourceFileName, childTile.matrix, isNew);
+					nodes[index].children.push_back(childTile.tileName);
+					if (isNew) _childTiles.push_back(childTile);
+					maxScreenDiameter = osg::minimum(maxScreenDiameter, pagedLOD.getMinRange(i));
+				}
+				else if (i < pagedLOD.getNumChildren())
+				{
+					pagedLOD.getChild(i)->accept(*this);
+				}
+			}
+			_currentNode = parentNode;
+			_imageStack.pop_back();
+
+			nodes[index].maxScreenDiameter = (maxScreenDiameter == FLT_MAX) ? 0.f : maxScreenDiameter;
+		}
+
+		virtual void apply(osg::Geometry& geometry)
+		{
+			if (_currentNode < 0)
+			{
+				if (_leafNode < 0)
+				{
+					_leafNode = (int)nodes.size();
+					nodes.push_back(Node3MXB());
+					nodes[_leafNode].id = "node" + std::to_string(_leafNode);
+				}
+				_currentNode = _leafNode;
+			}
+
+			GeometryEntry3MXB entry;
+			entry.geometry = &geometry;
+			entry.matrix = _matrixStack.back();
+			entry.image = getTextureImage(geometry.getStateSet());
+			if (!entry.image.valid()) entry.image = _imageStack.back();
+			nodes[_currentNode].geometries.push_back(entry);
+
+			if (_currentNode == _leafNode) _currentNode = -1;
+		}
+
+	private:
+		void pushStateSet(const osg::StateSet* stateSet)
+		{
+			osg::Image* image = getTextureImage(stateSet);
+			_imageStack.push_back(image ? image : _imageStack.back());
+		}
+
+		Writer3MXB& _writer;
+		std::vector<Writer3MXB::ChildTile>& _childTiles;
+		std::vector<osg::Matrix> _matrixStack;
+		std::vector<osg::Image*> _imageStack;
+		int _currentNode;
+		int _leafNode;
+	};
+}
+
+Writer3MXB::Writer3MXB(const osgDB::ReaderWriter::Options* options) :
+	_options(options),
+	_writeOptions(options),
+	_activeTasks(0),
+	_writtenTiles(0),
+	_failed(false)
+{
+}
+
+bool Writer3MXB::write(const osg::Node& node, const std::string& fileName)
+{
+	std::string ext = osgDB::getLowerCaseFileExtension(fileName);
+	std::string stem = osgDB::getStrippedName(fileName);
+
+	TileTask rootTask;
+	rootTask.node = &node;
+
+	if (ext == "3mx")
+	{
+		// a translation at the root becomes the layer offset
+		osg::Vec3d offset;
+		const osg::MatrixTransform* matrixTransform = dynamic_cast<const osg::MatrixTransform*>(&node);
+		if (matrixTransform && matrixTransform->getMatrix() == osg::Matrix::translate(matrixTransform->getMatrix().getTrans()))
+		{
+			offset = matrixTransform->getMatrix().getTrans();
+			rootTask.matrix = osg::Matrix::translate(-offset);
+		}
+
+		std::string rootDir = osgDB::getFilePath(fileName);
+		_outputDir = osgDB::concatPaths(rootDir, "Data");
+		rootTask.outputFileName = stem + ".3mxb";
+
+		neb::CJsonObject oJson_3mx;
+		oJson_3mx.Add("3mxVersion", 1);
+		oJson_3mx.Add("name", stem);
+		oJson_3mx.Add("description", std::string(""));
+		oJson_3mx.Add("logo", std::string(""));
+		oJson_3mx.AddEmptySubArray("sceneOptions");
+		oJson_3mx.AddEmptySubArray("layers");
+
+		neb::CJsonObject oJsonLayer;
+		oJsonLayer.Add("type", std::string("meshPyramid"));
+		oJsonLayer.Add("id", std::string("mesh0"));
+		oJsonLayer.Add("name", stem);
+		oJsonLayer.Add("description", std::string(""));
+		oJsonLayer.Add("SRS", std::string(""));
+		oJsonLayer.Add("root", "Data/" + rootTask.outputFileName);
+		if (offset != osg::Vec3d())
+		{
+			oJsonLayer.AddEmptySubArray("offset");
+			for (int j = 0; j < 3; ++j)
+			{
+				oJsonLayer["offset"].Add(offset[j]);
+			}
+		}
+		oJson_3mx["layers"].Add(oJsonLayer);
+
+		if (!osgDB::makeDirectory(_outputDir))
+		{
+			OSG_FATAL << "Writing file " << fileName << " failed! Can NOT create directory " << _outputDir << std::endl;
+			return false;
+		}
+
+		std::ofstream outFile_3mx(fileName, std::ios::out | std::ios::binary);
+		outFile_3mx << oJson_3mx.ToFormattedString();
+		if (!outFile_3mx)
+		{
+			OSG_FATAL << "Writing file " << fileName << " failed!" << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		_outputDir = osgDB::getFilePath(fileName);
+		rootTask.outputFileName = osgDB::getSimpleFileName(fileName);
+	}
+
+	_tileNames.insert(rootTask.outputFileName);
+	return writeTiles(rootTask);
+}
+
+std::string Writer3MXB::tileName(const std::string& sourceFileName, const osg::Matrix& matrix, bool& isNew)
+{
+	std::string stem = osgDB::getStrippedName(sourceFileName);
+	std::string sourceKey = osgDB::getRealPath(sourceFileName);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto& sourceTiles = _sourceTiles[sourceKey];
+	for (auto& sourceTile : sourceTiles)
+	{
+		if (sourceTile.first == matrix)
+		{
+			isNew = false;
+			return sourceTile.second;
+		}
+	}
+
+	std::string tileName = stem + ".3mxb";
+	for (int i = 1; _tileNames.count(tileName); ++i)
+	{
+		tileName = stem + "_" + std::to_string(i) + ".3mxb";
+	}
+	_tileNames.insert(tileName);
+	sourceTiles.push_back(std::make_pair(matrix, tileName));
+	isNew = true;
+	return tileName;
+}
+
+bool Writer3MXB::writeTiles(const TileTask& rootTask)
+{
+	_tasks.push_back(rootTask);
+
+	// tiles are also waiting on reads and writes, so a few threads per core
+	// could help, but not an unbounded number of them
+	unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	unsigned int threadsNum = _writeOptions.threads ? std::min(_writeOptions.threads, hardwareThreads * 4) : hardwareThreads;
+	std::vector<std::thread> threads;
+	threads.reserve(threadsNum);
+	for (unsigned int i = 1; i < threadsNum; ++i)
+	{
+		try
+		{
+			threads.push_back(std::thread(&Writer3MXB::runWorker, this));
+		}
+		catch (const std::system_error& e)
+		{
+			// fewer threads, the remaining tiles are written by the others
+			OSG_WARN << "3mxb writer: started " << threads.size() + 1 << " of " << threadsNum << " threads, " << e.what() << std::endl;
+			break;
+		}
+	}
+	runWorker();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	OSG_INFO << "3mxb writer: " << _writtenTiles << " tiles written to " << _outputDir << std::endl;
+	return !_failed;
+}
+
+void Writer3MXB::runWorker()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true)
+	{
+		_condition.wait(lock, [this]() { return !_tasks.empty() || !_activeTasks; });
+		if (_tasks.empty()) break;
+
+		TileTask task = _tasks.front();
+		_tasks.pop_front();
+		++_activeTasks;
+
+		lock.unlock();
+		bool succeeded = false;
+		try
+		{
+			succeeded = processTask(task);
+		}
+		catch (const std::exception& e)
+		{
+			OSG_FATAL << "3mxb writer: writing tile " << task.outputFileName << " failed, " << e.what() << std::endl;
+		}
+		catch (...)
+		{
+			OSG_FATAL << "3mxb writer: writing tile " << task.outputFileName << " failed." << std::endl;
+		}
+		lock.lock();
+
+		--_activeTasks;
+		if (succeeded) ++_writtenTiles;
+		else _failed = true;
+		_condition.notify_all();
+	}
+}
+
+bool Writer3MXB::processTask(const TileTask& task)
+{
+	osg::ref_ptr<const osg::Node> node = task.node;
+	if (!node.valid())
+	{
+		node = osgDB::readRefNodeFile(task.sourceFileName, _options.get());
+		if (!node.valid())
+		{
+			OSG_WARN << "3mxb writer: reading tile " << task.sourceFileName << " failed." << std::endl;
+			return false;
+		}
+	}
+
+	std::string buffer;
+	std::vector<ChildTile> childTiles;
+	if (!encodeTile(*node, task.matrix, buffer, childTiles))
+	{
+		return false;
+	}
+
+	std::string fileName = osgDB::concatPaths(_outputDir, task.outputFileName);
+	std::ofstream outFile(fileName, std::ios::out | std::ios::binary);
+	outFile.write(buffer.data(), buffer.size());
+	if (!outFile)
+	{
+		OSG_WARN << "3mxb writer: writing tile " << fileName << " failed." << std::endl;
+		return false;
+	}
+
+	if (!childTiles.empty())
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& childTile : childTiles)
+		{
+			TileTask childTask;
+			childTask.sourceFileName = childTile.sourceFileName;
+			childTask.outputFileName = childTile.tileName;
+			childTask.matrix = childTile.matrix;
+			_tasks.push_back(childTask);
+		}
+		_condition.notify_all();
+	}
+	return true;
+}
+
+bool Writer3MXB::encodeTile(const osg::Node& node, const osg::Matrix& matrix, std::string& buffer, std::vector<ChildTile>& childTiles)
+{
+	TileCollector collector(*this, matrix, childTiles);
+	const_cast<osg::Node&>(node).accept(collector);
+	if (collector.hasNestedPagedLOD)
+	{
+		OSG_FATAL << "3mxb writer: PagedLOD " << collector.nestedPagedLOD << " is nested in the content of another PagedLOD, which 3mxb nodes can not hold; only file children could be nested." << std::endl;
+		return false;
+	}
+
+	neb::CJsonObject oJson;
+	oJson.Add("version", 1);
+	oJson.AddEmptySubArray("nodes");
+	oJson.AddEmptySubArray("resources");
+
+	std::vector<std::string> buffers;
+	std::map<osg::Image*, std::string> mapTextureId;
+
+	osg::ref_ptr<osgDB::ReaderWriter::Options> jpegOptions = new osgDB::ReaderWriter::Options("JPEG_QUALITY " + std::to_string(_writeOptions.jpegQuality));
+	osgDB::ReaderWriter* jpegWriter = osgDB::Registry::instance()->getReaderWriterForExtension("jpg");
+
+	for (auto& node3MXB : collector.nodes)
+	{
+		neb::CJsonObject oJsonNode;
+		oJsonNode.Add("id", node3MXB.id);
+		oJsonNode.AddEmptySubArray("children");
+		for (auto& child : node3MXB.children)
+		{
+			oJsonNode["children"].Add(child);
+		}
+		oJsonNode.AddEmptySubArray("resources");
+
+		for (auto& entry : node3MXB.geometries)
+		{
+			const osg::Geometry* geometry = entry.geometry.get();
+			if (!geometry->getVertexArray() || !geometry->getVertexArray()->getNumElements()) continue;
+			std::vector<osg::Vec3> vertices;
+			if (!getVertices(geometry->getVertexArray(), vertices))
+			{
+				OSG_FATAL << "3mxb writer: geometry " << geometry->getName() << " has unsupported vertices, only Vec3Array and Vec3sArray ones could be written." << std::endl;
+				return false;
+			}
+
+			// transformed vertices
+			std::vector<CTMfloat> ctmVertices(vertices.size() * 3);
+			osg::BoundingBox bb;
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				osg::Vec3 v = vertices[i] * entry.matrix;
+				memcpy(&ctmVertices[i * 3], v.ptr(), sizeof(float) * 3);
+				bb.expandBy(v);
+			}
+			node3MXB.bb.expandBy(bb);
+
+			std::vector<CTMuint> ctmIndices;
+			osg::TriangleIndexFunctor<TriangleIndexCollector> triangleFunctor;
+			triangleFunctor.indices = &ctmIndices;
+			geometry->accept(triangleFunctor);
+
+			neb::CJsonObject oJsonResource;
+			std::string geometryId = "geometry" + std::to_string(buffers.size());
+			oJsonResource.Add("type", std::string("geometryBuffer"));
+			oJsonResource.Add("id", geometryId);
+			addToJsonArray(oJsonResource, "bbMin", bb._min);
+			addToJsonArray(oJsonResource, "bbMax", bb._max);
+
+			std::string geometryBuffer;
+			if (!ctmIndices.empty())
+			{
+				// mesh
+				std::vector<CTMfloat> ctmNormals;
+				std::vector<osg::Vec3> normals;
+				const osg::Array* normalArray = geometry->getNormalArray();
+				if (normalArray && normalArray->getNumElements() == vertices.size() && normalArray->getBinding() == osg::Array::BIND_PER_VERTEX
+					&& getNormals(normalArray, normals))
+				{
+					osg::Matrix inverse = osg::Matrix::inverse(entry.matrix);
+					ctmNormals.resize(normals.size() * 3);
+					for (size_t i = 0; i < normals.size(); ++i)
+					{
+						osg::Vec3 n = osg::Matrix::transform3x3(inverse, normals[i]);
+						n.normalize();
+						memcpy(&ctmNormals[i * 3], n.ptr(), sizeof(float) * 3);
+					}
+				}
+
+				std::vector<osg::Vec2> uvs;
+				const osg::Array* uvArray = geometry->getTexCoordArray(0);
+				if (uvArray && uvArray->getNumElements() == vertices.size() && !getUVs(*geometry, uvArray, uvs))
+				{
+					OSG_FATAL << "3mxb writer: geometry " << geometry->getName() << " has unsupported uvs, only Vec2Array and Vec2sArray ones could be written." << std::endl;
+					return false;
+				}
+				const CTMfloat* ctmUVs = uvs.empty() ? nullptr : (const CTMfloat*)&uvs[0];
+
+				if (_writeOptions.meshFormat == "fmc")
+				{
+					MeshCodec3MX::encode(&ctmVertices[0], ctmNormals.empty() ? nullptr : &ctmNormals[0], ctmUVs,
+						(uint32_t)vertices.size(), &ctmIndices[0], (uint32_t)ctmIndices.size(), geometryBuffer);
+				}
+				else
+				{
+					try
+					{
+						CTMexporter ctm;
+						ctm.DefineMesh(&ctmVertices[0], (CTMuint)vertices.size(), &ctmIndices[0], (CTMuint)(ctmIndices.size() / 3),
+							ctmNormals.empty() ? nullptr : &ctmNormals[0]);
+						if (ctmUVs)
+						{
+							ctm.AddUVMap(ctmUVs, "Diffuse color", nullptr);
+						}
+						ctm.CompressionMethod(CTM_METHOD_MG2);
+						ctm.VertexPrecisionRel(_writeOptions.ctmVertexPrecisionRel);
+						if (_writeOptions.ctmPreset == "fastEncode") ctm.CompressionPreset(CTM_PRESET_FAST_ENCODE);
+						else if (_writeOptions.ctmPreset == "maxRatio") ctm.CompressionPreset(CTM_PRESET_MAX_RATIO);
+						if (_writeOptions.ctmThreads > 1) ctm.CompressionThreads(_writeOptions.ctmThreads);
+						ctm.SaveCustom(_ctmStringWrite, &geometryBuffer);
+					}
+					catch (const ctm_error& e)
+					{
+						OSG_WARN << "3mxb writer: encoding ctm buffer failed! " << e.what() << std::endl;
+						return false;
+					}
+				}
+				oJsonResource.Add("format", _writeOptions.meshFormat);
+
+				// texture
+				if (ctmUVs && entry.image.valid() && jpegWriter)
+				{
+					auto itr = mapTextureId.find(entry.image.get());
+					if (itr == mapTextureId.end())
+					{
+						std::ostringstream textureStream;
+						if (jpegWriter->writeImage(*entry.image, textureStream, jpegOptions.get()).success())
+						{
+							std::string textureId = "texture" + std::to_string(buffers.size());
+							neb::CJsonObject oJsonTexture;
+							oJsonTexture.Add("type", std::string("textureBuffer"));
+							oJsonTexture.Add("format", std::string("jpg"));
+							oJsonTexture.Add("id", textureId);
+							oJsonTexture.Add("size", (int)textureStream.str().size());
+							oJson["resources"].Add(oJsonTexture);
+							buffers.push_back(textureStream.str());
+							itr = mapTextureId.insert(std::make_pair(entry.image.get(), textureId)).first;
+						}
+						else
+						{
+							OSG_WARN << "3mxb writer: encoding jpg texture failed." << std::endl;
+							itr = mapTextureId.insert(std::make_pair(entry.image.get(), std::string())).first;
+						}
+					}
+					if (!itr->second.empty())
+					{
+						oJsonResource.Add("texture", itr->second);
+					}
+				}
+			}
+			else
+			{
+				// point cloud
+				std::vector<osg::Vec4ub> colors(vertices.size(), osg::Vec4ub(255, 255, 255, 255));
+				const osg::Vec4Array* colorsF = dynamic_cast<const osg::Vec4Array*>(geometry->getColorArray());
+				const osg::Vec4ubArray* colorsB = dynamic_cast<const osg::Vec4ubArray*>(geometry->getColorArray());
+				if (colorsF && colorsF->size() == vertices.size())
+				{
+					for (size_t i = 0; i < colors.size(); ++i)
+					{
+						for (int j = 0; j < 4; ++j)
+						{
+							colors[i][j] = (unsigned char)osg::round(osg::clampBetween((*colorsF)[i][j], 0.f, 1.f) * 255.f);
+						}
+					}
+				}
+				else if (colorsB && colorsB->size() == vertices.size())
+				{
+					colors.assign(colorsB->begin(), colorsB->end());
+				}
+
+				int vertCount = (int)vertices.size();
+				geometryBuffer.append((const char*)&vertCount, 4);
+				geometryBuffer.append((const char*)&ctmVertices[0], ctmVertices.size() * sizeof(float));
+				geometryBuffer.append((const char*)&colors[0], colors.size() * sizeof(osg::Vec4ub));
+				oJsonResource.Add("format", std::string("xyz"));
+			}
+
+			oJsonResource.Add("size", (int)geometryBuffer.size());
+			oJson["resources"].Add(oJsonResource);
+			oJsonNode["resources"].Add(geometryId);
+			buffers.push_back(geometryBuffer);
+		}
+
+		if (!node3MXB.bb.valid())
+		{
+			node3MXB.bb.expandBy(osg::Vec3(0.f, 0.f, 0.f));
+		}
+		addToJsonArray(oJsonNode, "bbMin", node3MXB.bb._min);
+		addToJsonArray(oJsonNode, "bbMax", node3MXB.bb._max);
+		oJsonNode.Add("maxScreenDiameter", node3MXB.maxScreenDiameter);
+		oJson["nodes"].Add(oJsonNode);
+	}
+
+	std::string header = oJson.ToString();
+	uint32_t headerSize = (uint32_t)header.size();
+	buffer = "3MXBO";
+	buffer.append((const char*)&headerSize, 4);
+	buffer.append(header);
+	for (auto& resourceBuffer : buffers)
+	{
+		buffer.append(resourceBuffer);
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef WRITER_3MXB_H
+#define WRITER_3MXB_H
+
+#include <osg/Node>
+#include <osg/Matrix>
+#include <osgDB/ReaderWriter>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+struct WriteOptions3MX
+{
+	// number of tiles encoded concurrently, 0 for one per hardware thread
+	unsigned int threads = 0;
+	// MG2 vertex precision relative to the average edge length
+	float ctmVertexPrecisionRel = 0.01f;
+	// ctm compression preset: fastEncode, maxRatio or empty for the default level
+	std::string ctmPreset;
+	// threads compressing the arrays of a single ctm mesh concurrently
+	unsigned int ctmThreads = 1;
+	// geometryBuffer format of the meshes: ctm, or fmc for fast decoding (see MeshCodec3MX)
+	std::string meshFormat = "ctm";
+	int jpegQuality = 90;
+
+	WriteOptions3MX(const osgDB::ReaderWriter::Options* options);
+};
+
+// Writes an OSG scene as a .3mx root and .3mxb tiles. Every PagedLOD becomes
+// a 3mxb node whose file children are read back and written as child tiles,
+// once per source file even if several nodes refer to it; geometries outside
+// of PagedLODs are gathered into a single leaf node. 3mxb nodes only have
+// child tiles, so a PagedLOD nested in the content of another one fails the
+// write. Quantized arrays (see the quantizeVertices read option) are
+// dequantized. Independent tiles are encoded concurrently on a pool of worker
+// threads.
+class Writer3MXB
+{
+public:
+	Writer3MXB(const osgDB::ReaderWriter::Options* options);
+
+	// Writes a .3mx and its tiles under "Data/", or a single .3mxb tile tree.
+	bool write(const osg::Node& node, const std::string& fileName);
+
+	// Encodes a tile (without its child tiles) into .3mxb bytes. The file
+	// names of the child tiles are reported through childTiles.
+	struct ChildTile
+	{
+		std::string sourceFileName;
+		std::string tileName;
+		osg::Matrix matrix;
+	};
+	bool encodeTile(const osg::Node& node, const osg::Matrix& matrix, std::string& buffer, std::vector<ChildTile>& childTiles);
+
+	// Returns the output file name of the tile read from sourceFileName with
+	// matrix. A new name is reserved unless the same tile was already
+	// returned, isNew tells whether the tile still has to be written.
+	std::string tileName(const std::string& sourceFileName, const osg::Matrix& matrix, bool& isNew);
+
+private:
+	struct TileTask
+	{
+		osg::ref_ptr<const osg::Node> node;
+		std::string sourceFileName;
+		std::string outputFileName;
+		osg::Matrix matrix;
+	};
+
+	bool writeTiles(const TileTask& rootTask);
+	void runWorker();
+	bool processTask(const TileTask& task);
+
+	osg::ref_ptr<const osgDB::ReaderWriter::Options> _options;
+	WriteOptions3MX _writeOptions;
+
+	std::string _outputDir;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::deque<TileTask> _tasks;
+	std::set<std::string> _tileNames;
+	std::map<std::string, std::vector<std::pair<osg::Matrix, std::string> > > _sourceTiles;
+	unsigned int _activeTasks;
+	unsigned int _writtenTiles;
+	bool _failed;
+};
+
+#endif // WRITER_3MXB_H
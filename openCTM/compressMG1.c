@@ -110,30 +110,50 @@ static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreIndices() - Restore original indices (inverse derivative
-// operation).
+// operation). Returns CTM_FALSE if an index is out of range.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
+static CTMint _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
 {
-  CTMuint i;
-
+  CTMuint i, a, b, c, prevA, sum, prevSum, base, bad;
+
+  // The second index deltas chain within runs of triangles that share the
+  // same first index, and restart from the first index otherwise. Instead of
+  // adding to the previous second index through a branch, they are summed
+  // over all triangles, and the sum at the start of the current run (base)
+  // is subtracted, so every chain is a plain running sum kept in registers.
+  // Starting from zero gives the same result as special casing the first
+  // triangle.
+  prevA = sum = base = 0;
+  bad = 0;
   for(i = 0; i < self->mTriangleCount; ++ i)
   {
     // Step 1: Reverse derivative of the first triangle index
-    if(i >= 1)
-      aIndices[i * 3] += aIndices[(i - 1) * 3];
+    a = aIndices[i * 3] + prevA;
 
     // Step 2: Reverse delta from third triangle index to the first triangle
     // index
-    aIndices[i * 3 + 2] += aIndices[i * 3];
+    c = aIndices[i * 3 + 2] + a;
 
     // Step 3: Reverse delta from second triangle index to the previous
     // second triangle index, if the previous triangle shares the same first
     // index, otherwise reverse the delta to the first triangle index
-    if((i >= 1) && (aIndices[i * 3] == aIndices[(i - 1) * 3]))
-      aIndices[i * 3 + 1] += aIndices[(i - 1) * 3 + 1];
-    else
-      aIndices[i * 3 + 1] += aIndices[i * 3];
+    prevSum = sum;
+    sum += aIndices[i * 3 + 1];
+    base = (a == prevA) ? base : prevSum;
+    b = a + (sum - base);
+
+    aIndices[i * 3] = a;
+    aIndices[i * 3 + 1] = b;
+    aIndices[i * 3 + 2] = c;
+
+    // Range check of the restored triangle
+    bad |= (a >= self->mVertexCount) | (b >= self->mVertexCount) |
+           (c >= self->mVertexCount);
+
+    prevA = a;
   }
+
+  return bad ? CTM_FALSE : CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -260,13 +280,19 @@ int _ctmUncompressMesh_MG1(_CTMcontext * self)
   if(!_ctmStreamReadPackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
     return CTM_FALSE;
 
-  // Restore indices
-  _ctmRestoreIndices(self, indices);
+  // Restore indices, and check that they are within range
+  if(!_ctmRestoreIndices(self, indices))
+  {
+    self->mError = CTM_INVALID_MESH;
+    free(indices);
+    return CTM_FALSE;
+  }
   for(i = 0; i < self->mTriangleCount * 3; ++ i)
     self->mIndices[i] = indices[i];
 
   // Free temporary resources
   free(indices);
+  self->mChecked = _CTM_CHECKED_INDICES;
 
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
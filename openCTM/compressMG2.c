@@ -26,10 +26,23 @@
 //-----------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "openctm.h"
 #include "internal.h"
 
+// SSE2 is part of every x86-64 target
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+  #include <emmintrin.h>
+  #define _CTM_USE_SSE2
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #ifdef __DEBUG_
 #include <stdio.h>
 #endif
@@ -69,6 +82,17 @@ typedef struct {
   CTMuint mOriginalIndex;
 } _CTMsortvertex;
 
+//-----------------------------------------------------------------------------
+// _CTMradixitem - Element of the radix sort (64-bit key and a payload).
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Sort key. mKey[1] is the most significant word.
+  CTMuint mKey[2];
+
+  // Payload, carried along with the key.
+  CTMuint mValue;
+} _CTMradixitem;
+
 //-----------------------------------------------------------------------------
 // _ctmSetupGrid() - Setup the 3D space subdivision grid.
 //-----------------------------------------------------------------------------
@@ -172,43 +196,139 @@ static void _ctmGridIdxToPoint(_CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint
 }
 
 //-----------------------------------------------------------------------------
-// _compareVertex() - Comparator for the vertex sorting.
+// _ctmRadixSort() - Stable LSD radix sort of aCount items on their 64-bit
+// keys, using 8-bit digits. Digits that are the same for all items (e.g. the
+// upper bytes of the grid indices) are skipped.
 //-----------------------------------------------------------------------------
-static int _compareVertex(const void * elem1, const void * elem2)
+static int _ctmRadixSort(_CTMcontext * self, _CTMradixitem * aItems,
+  CTMuint aCount)
 {
-  _CTMsortvertex * v1 = (_CTMsortvertex *) elem1;
-  _CTMsortvertex * v2 = (_CTMsortvertex *) elem2;
-  if(v1->mGridIndex != v2->mGridIndex)
-    return v1->mGridIndex - v2->mGridIndex;
-  else if(v1->x < v2->x)
-    return -1;
-  else if(v1->x > v2->x)
-    return 1;
+  CTMuint hist[8][256];
+  _CTMradixitem * tmp, * src, * dst, * swap;
+  CTMuint i, j, key, sum, count, shift;
+  int pass;
+
+  if(aCount < 2)
+    return CTM_TRUE;
+
+  tmp = (_CTMradixitem *) malloc(sizeof(_CTMradixitem) * aCount);
+  if(!tmp)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Build the histograms of all digits in a single pass
+  memset(hist, 0, sizeof(hist));
+  for(i = 0; i < aCount; ++ i)
+  {
+    for(j = 0; j < 2; ++ j)
+    {
+      key = aItems[i].mKey[j];
+      ++ hist[j * 4][key & 0xff];
+      ++ hist[j * 4 + 1][(key >> 8) & 0xff];
+      ++ hist[j * 4 + 2][(key >> 16) & 0xff];
+      ++ hist[j * 4 + 3][key >> 24];
+    }
+  }
+
+  // Scatter the items once per digit, least significant digit first
+  src = aItems;
+  dst = tmp;
+  for(pass = 0; pass < 8; ++ pass)
+  {
+    j = pass >> 2;
+    shift = (pass & 3) * 8;
+    if(hist[pass][(src[0].mKey[j] >> shift) & 0xff] == aCount)
+      continue;
+
+    sum = 0;
+    for(i = 0; i < 256; ++ i)
+    {
+      count = hist[pass][i];
+      hist[pass][i] = sum;
+      sum += count;
+    }
+    for(i = 0; i < aCount; ++ i)
+      dst[hist[pass][(src[i].mKey[j] >> shift) & 0xff] ++] = src[i];
+
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if(src != aItems)
+    memcpy(aItems, src, sizeof(_CTMradixitem) * aCount);
+
+  free((void *) tmp);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFloatSortKey() - Map a float to an unsigned integer with the same
+// ordering (-0 and +0 map to the same key, as they compare equal).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFloatSortKey(CTMfloat aValue)
+{
+  union {
+    CTMfloat f;
+    CTMuint i;
+  } bits;
+  bits.f = aValue;
+  if(aValue == 0.0f)
+    bits.i = 0;
+  if(bits.i & 0x80000000)
+    return ~bits.i;
   else
-    return 0;
+    return bits.i | 0x80000000;
 }
 
 //-----------------------------------------------------------------------------
 // _ctmSortVertices() - Setup the vertex array. Assign each vertex to a grid
 // box, and sort all vertices.
 //-----------------------------------------------------------------------------
-static void _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
+static int _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
   _CTMgrid * aGrid)
 {
-  CTMuint i;
+  _CTMradixitem * items;
+  CTMuint i, idx;
 
-  // Prepare sort vertex array
+  items = (_CTMradixitem *) malloc(sizeof(_CTMradixitem) * self->mVertexCount);
+  if(!items)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Prepare sort items: the key is the grid index (most significant) and the
+  // x coordinate, the payload is the original index
   for(i = 0; i < self->mVertexCount; ++ i)
   {
-    // Store vertex properties in the sort vertex array
-    aSortVertices[i].x = self->mVertices[i * 3];
-    aSortVertices[i].mGridIndex = _ctmPointToGridIdx(aGrid, &self->mVertices[i * 3]);
-    aSortVertices[i].mOriginalIndex = i;
+    items[i].mKey[1] = _ctmPointToGridIdx(aGrid, &self->mVertices[i * 3]);
+    items[i].mKey[0] = _ctmFloatSortKey(self->mVertices[i * 3]);
+    items[i].mValue = i;
   }
 
   // Sort vertices. The elements are first sorted by their grid indices, and
-  // scondly by their x coordinates.
-  qsort((void *) aSortVertices, self->mVertexCount, sizeof(_CTMsortvertex), _compareVertex);
+  // scondly by their x coordinates. Equal vertices keep their original order.
+  if(!_ctmRadixSort(self, items, self->mVertexCount))
+  {
+    free((void *) items);
+    return CTM_FALSE;
+  }
+
+  // Store vertex properties in the sort vertex array
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    idx = items[i].mValue;
+    aSortVertices[i].x = self->mVertices[idx * 3];
+    aSortVertices[i].mGridIndex = items[i].mKey[1];
+    aSortVertices[i].mOriginalIndex = idx;
+  }
+
+  free((void *) items);
+
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -239,25 +359,13 @@ static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices
   return CTM_TRUE;
 }
 
-//-----------------------------------------------------------------------------
-// _compareTriangle() - Comparator for the triangle sorting.
-//-----------------------------------------------------------------------------
-static int _compareTriangle(const void * elem1, const void * elem2)
-{
-  CTMuint * tri1 = (CTMuint *) elem1;
-  CTMuint * tri2 = (CTMuint *) elem2;
-  if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
-}
-
 //-----------------------------------------------------------------------------
 // _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
 // compression.
 //-----------------------------------------------------------------------------
-static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
+static int _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
 {
+  _CTMradixitem * items;
   CTMuint * tri, tmp, i;
 
   // Step 1: Make sure that the first index of each triangle is the smallest
@@ -281,8 +389,36 @@ static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
     }
   }
 
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
+  // Step 2: Sort the triangles based on the first and second triangle index
+  items = (_CTMradixitem *) malloc(sizeof(_CTMradixitem) * self->mTriangleCount);
+  if(!items)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  for(i = 0; i < self->mTriangleCount; ++ i)
+  {
+    tri = &aIndices[i * 3];
+    items[i].mKey[1] = tri[0];
+    items[i].mKey[0] = tri[1];
+    items[i].mValue = tri[2];
+  }
+  if(!_ctmRadixSort(self, items, self->mTriangleCount))
+  {
+    free((void *) items);
+    return CTM_FALSE;
+  }
+  for(i = 0; i < self->mTriangleCount; ++ i)
+  {
+    tri = &aIndices[i * 3];
+    tri[0] = items[i].mKey[1];
+    tri[1] = items[i].mKey[0];
+    tri[2] = items[i].mValue;
+  }
+
+  free((void *) items);
+
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -313,31 +449,81 @@ static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmRestoreIndices() - Restore original indices (inverse derivative
-// operation).
+// _ctmRestoreGridIndices() - Restore grid indices (inclusive prefix sum of
+// the deltas). With SSE2, four indices are summed at a time: each vector is
+// scanned in register with two shifted adds, and the last sum is carried over
+// to the next vector.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
+static void _ctmRestoreGridIndices(CTMuint * aGridIndices, CTMuint aCount)
 {
-  CTMuint i;
+  CTMuint i = 1;
+#ifdef _CTM_USE_SSE2
+  __m128i x, carry;
 
+  carry = _mm_setzero_si128();
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    x = _mm_loadu_si128((const __m128i *) &aGridIndices[i]);
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, carry);
+    _mm_storeu_si128((__m128i *) &aGridIndices[i], x);
+    carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  if(i < 1)
+    i = 1;
+#endif
+
+  for(; i < aCount; ++ i)
+    aGridIndices[i] += aGridIndices[i - 1];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreIndices() - Restore original indices (inverse derivative
+// operation). Returns CTM_FALSE if an index is out of range.
+//-----------------------------------------------------------------------------
+static CTMint _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
+{
+  CTMuint i, a, b, c, prevA, sum, prevSum, base, bad;
+
+  // The second index deltas chain within runs of triangles that share the
+  // same first index, and restart from the first index otherwise. Instead of
+  // adding to the previous second index through a branch, they are summed
+  // over all triangles, and the sum at the start of the current run (base)
+  // is subtracted, so every chain is a plain running sum kept in registers.
+  // Starting from zero gives the same result as special casing the first
+  // triangle.
+  prevA = sum = base = 0;
+  bad = 0;
   for(i = 0; i < self->mTriangleCount; ++ i)
   {
     // Step 1: Reverse derivative of the first triangle index
-    if(i >= 1)
-      aIndices[i * 3] += aIndices[(i - 1) * 3];
+    a = aIndices[i * 3] + prevA;
 
     // Step 2: Reverse delta from third triangle index to the first triangle
     // index
-    aIndices[i * 3 + 2] += aIndices[i * 3];
+    c = aIndices[i * 3 + 2] + a;
 
     // Step 3: Reverse delta from second triangle index to the previous
     // second triangle index, if the previous triangle shares the same first
     // index, otherwise reverse the delta to the first triangle index
-    if((i >= 1) && (aIndices[i * 3] == aIndices[(i - 1) * 3]))
-      aIndices[i * 3 + 1] += aIndices[(i - 1) * 3 + 1];
-    else
-      aIndices[i * 3 + 1] += aIndices[i * 3];
+    prevSum = sum;
+    sum += aIndices[i * 3 + 1];
+    base = (a == prevA) ? base : prevSum;
+    b = a + (sum - base);
+
+    aIndices[i * 3] = a;
+    aIndices[i * 3 + 1] = b;
+    aIndices[i * 3 + 2] = c;
+
+    // Range check of the restored triangle
+    bad |= (a >= self->mVertexCount) | (b >= self->mVertexCount) |
+           (c >= self->mVertexCount);
+
+    prevA = a;
   }
+
+  return bad ? CTM_FALSE : CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -383,16 +569,19 @@ static void _ctmMakeVertexDeltas(_CTMcontext * self, CTMint * aIntVertices,
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreVertices() - Calculate inverse derivatives of the vertices.
+// Returns the ORed _CTM_NONFINITE_BITS() of the restored coordinates.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
+static CTMuint _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
   CTMuint * aGridIndices, _CTMgrid * aGrid, CTMfloat * aVertices)
 {
-  CTMuint i, gridIdx, prevGridIndex;
+  CTMuint i, gridIdx, prevGridIndex, acc;
   CTMfloat gridOrigin[3], scale;
   CTMint deltaX, prevDeltaX;
+  _CTMfloatbits x, y, z;
 
   scale = self->mVertexPrecision;
 
+  acc = 0;
   prevGridIndex = 0x7fffffff;
   prevDeltaX = 0;
   for(i = 0; i < self->mVertexCount; ++ i)
@@ -405,36 +594,69 @@ static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
     deltaX = aIntVertices[i * 3];
     if(gridIdx == prevGridIndex)
       deltaX += prevDeltaX;
-    aVertices[i * 3] = scale * deltaX + gridOrigin[0];
-    aVertices[i * 3 + 1] = scale * aIntVertices[i * 3 + 1] + gridOrigin[1];
-    aVertices[i * 3 + 2] = scale * aIntVertices[i * 3 + 2] + gridOrigin[2];
+    x.f = scale * deltaX + gridOrigin[0];
+    y.f = scale * aIntVertices[i * 3 + 1] + gridOrigin[1];
+    z.f = scale * aIntVertices[i * 3 + 2] + gridOrigin[2];
+    aVertices[i * 3] = x.f;
+    aVertices[i * 3 + 1] = y.f;
+    aVertices[i * 3 + 2] = z.f;
+    acc |= _CTM_NONFINITE_BITS(x.u) | _CTM_NONFINITE_BITS(y.u) |
+           _CTM_NONFINITE_BITS(z.u);
 
     prevGridIndex = gridIdx;
     prevDeltaX = deltaX;
   }
+
+  return acc;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
-// These are used as the nominal normals for normal deltas & reconstruction.
+// _CTMnormalrange - A vertex range of the smooth normals, calculated by one
+// thread.
 //-----------------------------------------------------------------------------
-static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
-  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+typedef struct {
+  _CTMcontext * mContext;
+  CTMfloat * mVertices;
+  CTMuint * mIndices;
+  CTMfloat * mSmoothNormals;
+  CTMuint mFirst, mEnd;
+} _CTMnormalrange;
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormalRange() - Calculate the smooth normals of the vertices
+// in [mFirst, mEnd). The flat normals of all triangles with a corner in the
+// range are summed in triangle order, exactly like for the whole mesh, so the
+// result does not depend on how the vertices are split into ranges.
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI _ctmCalcSmoothNormalRange(LPVOID aRange)
+#else
+static void * _ctmCalcSmoothNormalRange(void * aRange)
+#endif
 {
+  _CTMnormalrange * range = (_CTMnormalrange *) aRange;
+  CTMfloat * aVertices = range->mVertices;
+  CTMuint * aIndices = range->mIndices;
+  CTMfloat * aSmoothNormals = range->mSmoothNormals;
+  CTMuint first = range->mFirst, count = range->mEnd - range->mFirst;
   CTMuint i, j, k, tri[3];
   CTMfloat len;
   CTMfloat v1[3], v2[3], n[3];
 
   // Clear smooth normals array
-  for(i = 0; i < 3 * self->mVertexCount; ++ i)
+  for(i = 3 * range->mFirst; i < 3 * range->mEnd; ++ i)
     aSmoothNormals[i] = 0.0f;
 
   // Calculate sums of all neigbouring triangle normals for each vertex
-  for(i = 0; i < self->mTriangleCount; ++ i)
+  for(i = 0; i < range->mContext->mTriangleCount; ++ i)
   {
-    // Get triangle corner indices
+    // Get triangle corner indices, and skip the triangle if none of them is
+    // in the range (the unsigned differences wrap below the range)
     for(j = 0; j < 3; ++ j)
       tri[j] = aIndices[i * 3 + j];
+    if((tri[0] - first >= count) && (tri[1] - first >= count) &&
+       (tri[2] - first >= count))
+      continue;
 
     // Calculate the normalized cross product of two triangle edges (i.e. the
     // flat triangle normal)
@@ -454,14 +676,15 @@ static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
     for(j = 0; j < 3; ++ j)
       n[j] *= len;
 
-    // Add the flat normal to all three triangle vertices
+    // Add the flat normal to the triangle vertices in the range
     for(k = 0; k < 3; ++ k)
-      for(j = 0; j < 3; ++ j)
-        aSmoothNormals[tri[k] * 3 + j] += n[j];
+      if(tri[k] - first < count)
+        for(j = 0; j < 3; ++ j)
+          aSmoothNormals[tri[k] * 3 + j] += n[j];
   }
 
   // Normalize the normal sums, which gives the unit length smooth normals
-  for(i = 0; i < self->mVertexCount; ++ i)
+  for(i = range->mFirst; i < range->mEnd; ++ i)
   {
     len = sqrtf(aSmoothNormals[i * 3] * aSmoothNormals[i * 3] + 
                 aSmoothNormals[i * 3 + 1] * aSmoothNormals[i * 3 + 1] +
@@ -473,6 +696,82 @@ static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
     for(j = 0; j < 3; ++ j)
       aSmoothNormals[i * 3 + j] *= len;
   }
+
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
+// These are used as the nominal normals for normal deltas & reconstruction.
+// Meshes of _CTM_PARALLEL_NORMALS_MIN_TRIANGLES triangles or more are split
+// into vertex ranges, calculated by up to mCompressionThreads (export) or
+// mDecompressionThreads (import) threads. The smooth normals are identical to
+// those of a single thread, which the encoder and the decoder must agree on.
+//-----------------------------------------------------------------------------
+#define _CTM_PARALLEL_NORMALS_MIN_TRIANGLES 65536
+#define _CTM_MAX_NORMAL_THREADS 64
+
+static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
+  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+{
+  _CTMnormalrange ranges[_CTM_MAX_NORMAL_THREADS];
+  CTMuint i, threadCount, started;
+#ifdef _WIN32
+  HANDLE threads[_CTM_MAX_NORMAL_THREADS];
+#else
+  pthread_t threads[_CTM_MAX_NORMAL_THREADS];
+#endif
+
+  threadCount = (self->mMode == CTM_EXPORT) ? self->mCompressionThreads :
+                self->mDecompressionThreads;
+  if(threadCount > _CTM_MAX_NORMAL_THREADS)
+    threadCount = _CTM_MAX_NORMAL_THREADS;
+  if((self->mTriangleCount < _CTM_PARALLEL_NORMALS_MIN_TRIANGLES) ||
+     (self->mVertexCount < threadCount))
+    threadCount = 1;
+
+  // Split the vertices into one range per thread
+  for(i = 0; i < threadCount; ++ i)
+  {
+    ranges[i].mContext = self;
+    ranges[i].mVertices = aVertices;
+    ranges[i].mIndices = aIndices;
+    ranges[i].mSmoothNormals = aSmoothNormals;
+    ranges[i].mFirst = (CTMuint) (((double) self->mVertexCount * i) / threadCount);
+    ranges[i].mEnd = (CTMuint) (((double) self->mVertexCount * (i + 1)) / threadCount);
+  }
+
+  // Start a thread per range but the first, which is calculated by this
+  // thread. If a thread can not be started, the remaining ranges are
+  // calculated by this thread too.
+  for(started = 1; started < threadCount; ++ started)
+  {
+#ifdef _WIN32
+    threads[started] = CreateThread(NULL, 0, _ctmCalcSmoothNormalRange, &ranges[started], 0, NULL);
+    if(!threads[started])
+      break;
+#else
+    if(pthread_create(&threads[started], NULL, _ctmCalcSmoothNormalRange, &ranges[started]) != 0)
+      break;
+#endif
+  }
+  _ctmCalcSmoothNormalRange(&ranges[0]);
+  if(started < threadCount)
+  {
+    ranges[started].mEnd = ranges[threadCount - 1].mEnd;
+    _ctmCalcSmoothNormalRange(&ranges[started]);
+  }
+
+  // Wait for the threads
+  for(i = 1; i < started; ++ i)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -608,15 +907,19 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreNormals() - Convert the normals back to cartesian coordinates.
+// The ORed _CTM_NONFINITE_BITS() of the restored normals are stored in aAcc.
 //-----------------------------------------------------------------------------
-static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
+static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals,
+  CTMuint * aAcc)
 {
-  CTMuint i, j, intPhi;
+  CTMuint i, j, intPhi, acc;
   CTMfloat magn, phi, theta, scale, thetaScale;
   CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  _CTMfloatbits bits;
 
-  // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
+  // Get temporary memory for the nominal vertex normals
+  smoothNormals = (CTMfloat *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP2,
+    3 * sizeof(CTMfloat) * self->mVertexCount);
   if(!smoothNormals)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -629,6 +932,7 @@ static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
   // Normal scaling factor
   scale = self->mNormalPrecision;
 
+  acc = 0;
   for(i = 0; i < self->mVertexCount; ++ i)
   {
     // Get the normal magnitude from the first of the three normal elements
@@ -658,11 +962,13 @@ static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
 
     // Apply normal magnitude, and output to the normals array
     for(j = 0; j < 3; ++ j)
-      self->mNormals[i * 3 + j] = n[j] * magn;
+    {
+      bits.f = n[j] * magn;
+      self->mNormals[i * 3 + j] = bits.f;
+      acc |= _CTM_NONFINITE_BITS(bits.u);
+    }
   }
-
-  // Free temporary resources
-  free(smoothNormals);
+  *aAcc = acc;
 
   return CTM_TRUE;
 }
@@ -704,18 +1010,20 @@ static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreUVCoords() - Calculate inverse derivatives of the UV
-// coordinates.
+// coordinates. Returns the ORed _CTM_NONFINITE_BITS() of the coordinates.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreUVCoords(_CTMcontext * self, _CTMfloatmap * aMap,
+static CTMuint _ctmRestoreUVCoords(_CTMcontext * self, _CTMfloatmap * aMap,
   CTMint * aIntUVCoords)
 {
-  CTMuint i;
+  CTMuint i, acc;
   CTMint u, v, prevU, prevV;
   CTMfloat scale;
+  _CTMfloatbits fu, fv;
 
   // UV coordinate scaling factor
   scale = aMap->mPrecision;
 
+  acc = 0;
   prevU = prevV = 0;
   for(i = 0; i < self->mVertexCount; ++ i)
   {
@@ -724,12 +1032,17 @@ static void _ctmRestoreUVCoords(_CTMcontext * self, _CTMfloatmap * aMap,
     v = aIntUVCoords[i * 2 + 1] + prevV;
 
     // Convert to floating point
-    aMap->mValues[i * 2] = (CTMfloat) u * scale;
-    aMap->mValues[i * 2 + 1] = (CTMfloat) v * scale;
+    fu.f = (CTMfloat) u * scale;
+    fv.f = (CTMfloat) v * scale;
+    aMap->mValues[i * 2] = fu.f;
+    aMap->mValues[i * 2 + 1] = fv.f;
+    acc |= _CTM_NONFINITE_BITS(fu.u) | _CTM_NONFINITE_BITS(fv.u);
 
     prevU = u;
     prevV = v;
   }
+
+  return acc;
 }
 
 //-----------------------------------------------------------------------------
@@ -770,18 +1083,21 @@ static void _ctmMakeAttribDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreAttribs() - Calculate inverse derivatives of the vertex
-// attributes.
+// attributes. Returns the ORed _CTM_NONFINITE_BITS() of the attributes.
 //-----------------------------------------------------------------------------
-static void _ctmRestoreAttribs(_CTMcontext * self, _CTMfloatmap * aMap,
+static CTMuint _ctmRestoreAttribs(_CTMcontext * self, _CTMfloatmap * aMap,
   CTMint * aIntAttribs)
 {
-  CTMuint i, j;
+  CTMuint i, j, acc;
   CTMint value[4], prev[4];
   CTMfloat scale;
+  _CTMfloatbits bits;
 
   // Attribute scaling factor
   scale = aMap->mPrecision;
 
+  acc = 0;
+
   for(j = 0; j < 4; ++ j)
     prev[j] = 0;
 
@@ -791,10 +1107,14 @@ static void _ctmRestoreAttribs(_CTMcontext * self, _CTMfloatmap * aMap,
     for(j = 0; j < 4; ++ j)
     {
       value[j] = aIntAttribs[i * 4 + j] + prev[j];
-      aMap->mValues[i * 4 + j] = (CTMfloat) value[j] * scale;
+      bits.f = (CTMfloat) value[j] * scale;
+      aMap->mValues[i * 4 + j] = bits.f;
+      acc |= _CTM_NONFINITE_BITS(bits.u);
       prev[j] = value[j];
     }
   }
+
+  return acc;
 }
 
 //-----------------------------------------------------------------------------
@@ -839,7 +1159,11 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-  _ctmSortVertices(self, sortVertices, &grid);
+  if(!_ctmSortVertices(self, sortVertices, &grid))
+  {
+    free((void *) sortVertices);
+    return CTM_FALSE;
+  }
 
   // Convert vertices to integers and calculate vertex deltas (entropy-reduction)
   intVertices = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
@@ -926,7 +1250,13 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
     free((void *) sortVertices);
     return CTM_FALSE;
   }
-  _ctmReArrangeTriangles(self, indices);
+  if(!_ctmReArrangeTriangles(self, indices))
+  {
+    free((void *) indices);
+    free((void *) restoredVertices);
+    free((void *) sortVertices);
+    return CTM_FALSE;
+  }
 
   // Calculate index deltas (entropy-reduction)
   deltaIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
@@ -1083,7 +1413,7 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_MG2(_CTMcontext * self)
 {
-  CTMuint * gridIndices, i;
+  CTMuint * gridIndices, i, acc, normalAcc;
   CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
   _CTMfloatmap * map;
   _CTMgrid grid;
@@ -1138,49 +1468,37 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
+  intVertices = (CTMint *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP1,
+    sizeof(CTMint) * self->mVertexCount * 3);
   if(!intVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
   if(!_ctmStreamReadPackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
-  {
-    free((void *) intVertices);
     return CTM_FALSE;
-  }
 
   // Read grid indices
   if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
   {
-    free((void *) intVertices);
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  gridIndices = (CTMuint *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP2,
+    sizeof(CTMuint) * self->mVertexCount);
   if(!gridIndices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
     return CTM_FALSE;
   }
   if(!_ctmStreamReadPackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
-  {
-    free((void *) gridIndices);
-    free((void *) intVertices);
     return CTM_FALSE;
-  }
 
   // Restore grid indices (deltas)
-  for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] += gridIndices[i - 1];
+  _ctmRestoreGridIndices(gridIndices, self->mVertexCount);
 
   // Restore vertices
-  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices);
-
-  // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
+  acc = _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices);
 
   // Read triangle indices
   if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
@@ -1191,23 +1509,19 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
   if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
     return CTM_FALSE;
 
-  // Restore indices
-  _ctmRestoreIndices(self, self->mIndices);
-
-  // Check that all indices are within range
-  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  // Restore indices, and check that they are within range (the normals are
+  // restored from the triangles)
+  if(!_ctmRestoreIndices(self, self->mIndices))
   {
-    if(self->mIndices[i] >= self->mVertexCount)
-    {
-      self->mError = CTM_INVALID_MESH;
-      return CTM_FALSE;
-    }
+    self->mError = CTM_INVALID_MESH;
+    return CTM_FALSE;
   }
 
   // Read normals
   if(self->mNormals)
   {
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
+    intNormals = (CTMint *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP1,
+      sizeof(CTMint) * self->mVertexCount * 3);
     if(!intNormals)
     {
       self->mError = CTM_OUT_OF_MEMORY;
@@ -1216,31 +1530,23 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intNormals);
       return CTM_FALSE;
     }
     if(!_ctmStreamReadPackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) intNormals);
       return CTM_FALSE;
-    }
 
     // Restore normals
-    if(!_ctmRestoreNormals(self, intNormals))
-    {
-      free((void *) intNormals);
+    if(!_ctmRestoreNormals(self, intNormals, &normalAcc))
       return CTM_FALSE;
-    }
-
-    // Free temporary normals data
-    free((void *) intNormals);
+    acc |= normalAcc;
   }
 
   // Read UV maps
   map = self->mUVMaps;
   while(map)
   {
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 2);
+    intUVCoords = (CTMint *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP1,
+      sizeof(CTMint) * self->mVertexCount * 2);
     if(!intUVCoords)
     {
       self->mError = CTM_OUT_OF_MEMORY;
@@ -1249,7 +1555,6 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1258,20 +1563,13 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
     if(!_ctmStreamReadPackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
       return CTM_FALSE;
-    }
 
     // Restore UV coordinates
-    _ctmRestoreUVCoords(self, map, intUVCoords);
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
+    acc |= _ctmRestoreUVCoords(self, map, intUVCoords);
 
     map = map->mNext;
   }
@@ -1280,7 +1578,8 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 4);
+    intAttribs = (CTMint *) _ctmStreamBuffer(self, _CTM_BUFFER_TEMP1,
+      sizeof(CTMint) * self->mVertexCount * 4);
     if(!intAttribs)
     {
       self->mError = CTM_OUT_OF_MEMORY;
@@ -1289,7 +1588,6 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1297,23 +1595,24 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
     if(!_ctmStreamReadPackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
       return CTM_FALSE;
-    }
 
     // Restore vertex attributes
-    _ctmRestoreAttribs(self, map, intAttribs);
-
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
+    acc |= _ctmRestoreAttribs(self, map, intAttribs);
 
     map = map->mNext;
   }
 
+  // All values were checked while restoring them
+  if((self->mValidation == CTM_VALIDATE_FULL) && _CTM_NONFINITE(acc))
+  {
+    self->mError = CTM_INVALID_MESH;
+    return CTM_FALSE;
+  }
+  self->mChecked = _CTM_CHECKED_INDICES | _CTM_CHECKED_FLOATS;
+
   return CTM_TRUE;
 }
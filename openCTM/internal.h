@@ -28,6 +28,8 @@
 #ifndef __OPENCTM_INTERNAL_H_
 #define __OPENCTM_INTERNAL_H_
 
+#include <stddef.h>
+
 //-----------------------------------------------------------------------------
 // Constants
 //-----------------------------------------------------------------------------
@@ -50,6 +52,47 @@ struct _CTMfloatmap_struct {
   _CTMfloatmap * mNext; // Pointer to the next map in the list (linked list)
 };
 
+//-----------------------------------------------------------------------------
+// _CTMstreamchunk - Pending output of a deferred stream. A chunk holds either
+// raw bytes, or an interleaved array that is LZMA compressed when the stream
+// is flushed.
+//-----------------------------------------------------------------------------
+typedef struct _CTMstreamchunk_struct _CTMstreamchunk;
+struct _CTMstreamchunk_struct {
+  unsigned char * mData;     // Raw bytes or uncompressed interleaved array
+  CTMuint mSize;             // Size of mData in bytes
+  CTMuint mCapacity;         // Allocated size of mData (raw chunks only)
+  CTMint mPack;              // Non-zero if mData shall be LZMA compressed
+  unsigned char * mPacked;   // LZMA compressed data
+  CTMuint mPackedSize;       // Size of mPacked in bytes
+  unsigned char mProps[5];   // LZMA compression props
+  int mLzmaRes;              // LZMA result code
+  double mLzmaTime;          // Seconds spent compressing the chunk
+  _CTMstreamchunk * mNext;   // Pointer to the next chunk (linked list)
+};
+
+//-----------------------------------------------------------------------------
+// _CTMstreamcache - Memory that is reused from one load to the next: the LZMA
+// decoder state (probability tables), and buffers for the packed and the
+// interleaved data of an array, and for temporary arrays of the decoders (see
+// _ctmStreamBuffer()). They only grow while loading; ctmResetContext() keeps
+// the buffers of up to _CTM_CACHE_MAX_BUFFER_SIZE bytes and frees the larger
+// ones, so that a single large mesh does not pin its peak memory in a context
+// that is reused for the life of a process.
+//-----------------------------------------------------------------------------
+#define _CTM_CACHE_MAX_BUFFER_SIZE (4 << 20)
+#define _CTM_BUFFER_PACKED   0
+#define _CTM_BUFFER_UNPACKED 1
+#define _CTM_BUFFER_TEMP1    2
+#define _CTM_BUFFER_TEMP2    3
+#define _CTM_BUFFER_COUNT    4
+
+typedef struct {
+  void * mLzmaDecoder;
+  unsigned char * mBuffers[_CTM_BUFFER_COUNT];
+  size_t mBufferSizes[_CTM_BUFFER_COUNT];
+} _CTMstreamcache;
+
 //-----------------------------------------------------------------------------
 // _CTMcontext - Internal CTM context structure.
 //-----------------------------------------------------------------------------
@@ -85,6 +128,34 @@ typedef struct {
   // The selected compression level
   CTMuint mCompressionLevel;
 
+  // LZMA encoder settings (0 for dict size and -1 for the others means that
+  // the value is derived from the compression level)
+  CTMuint mLzmaDictSize;
+  int mLzmaLc, mLzmaLp, mLzmaPb, mLzmaFb, mLzmaAlgo;
+
+  // Number of threads for compressing the packed arrays of a mesh
+  CTMuint mCompressionThreads;
+
+  // Number of threads for the decoding steps of a large mesh that can be
+  // split (smooth normals of MG2)
+  CTMuint mDecompressionThreads;
+
+  // Seconds spent in LZMA (de)compression by the last load/save
+  double mLzmaTime;
+
+  // Load validation level, and the checks that the decoder has already done
+  // while restoring the arrays (_CTM_CHECKED_* bits)
+  CTMenum mValidation;
+  CTMuint mChecked;
+
+  // Reused stream memory
+  _CTMstreamcache mStreamCache;
+
+  // Deferred stream output (see _ctmStreamBeginDeferred())
+  CTMint mDeferred;
+  _CTMstreamchunk * mFirstChunk;
+  _CTMstreamchunk * mLastChunk;
+
   // Vertex coordinate precision
   CTMfloat mVertexPrecision;
 
@@ -102,6 +173,15 @@ typedef struct {
 
   // User data (for stream read/write - usually the stream handle)
   void * mUserData;
+
+  // Memory source of ctmLoadFromMemory(): read position and end (NULL when
+  // reading through mReadFn), and whether a read went past the end
+  const unsigned char * mReadData;
+  const unsigned char * mReadEnd;
+  CTMint mReadOverrun;
+
+  // Number of bytes read by the last load
+  CTMuint mReadCount;
 } _CTMcontext;
 
 //-----------------------------------------------------------------------------
@@ -110,6 +190,22 @@ typedef struct {
 #define FOURCC(str) (((CTMuint) str[0]) | (((CTMuint) str[1]) << 8) | \
                     (((CTMuint) str[2]) << 16) | (((CTMuint) str[3]) << 24))
 
+// Checks done by a decoder while restoring the mesh arrays
+#define _CTM_CHECKED_INDICES 0x00000001
+#define _CTM_CHECKED_FLOATS  0x00000002
+
+// Branch free finiteness check of the bits of a float (see _CTMfloatbits):
+// the sign bit of the result is set for an infinity or a NaN (all exponent
+// bits set). ORing the results of an array lets a loop check it without
+// branching per value.
+#define _CTM_NONFINITE_BITS(x) (((x) & 0x7f800000) + 0x00800000)
+#define _CTM_NONFINITE(acc) (((acc) & 0x80000000) != 0)
+
+typedef union {
+  CTMfloat f;
+  CTMuint u;
+} _CTMfloatbits;
+
 //-----------------------------------------------------------------------------
 // Funcion prototypes for stream.c
 //-----------------------------------------------------------------------------
@@ -125,6 +221,11 @@ int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount,
 int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
 int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
 int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
+void * _ctmStreamBuffer(_CTMcontext * self, CTMuint aIdx, size_t aSize);
+void _ctmStreamFreeCache(_CTMcontext * self);
+void _ctmStreamTrimCache(_CTMcontext * self, size_t aMaxSize);
+void _ctmStreamBeginDeferred(_CTMcontext * self);
+int _ctmStreamEndDeferred(_CTMcontext * self);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressRAW.c
@@ -33,14 +33,6 @@
 #include "internal.h"
 
 
-// The C99 macro isfinite() is not supported on all platforms (specifically,
-// MS Visual Studio does not support C99)
-#if !defined(isfinite) && defined(_MSC_VER)
-  #include <float.h>
-  #define isfinite(x) _finite(x)
-#endif
-
-
 //-----------------------------------------------------------------------------
 // _ctmFreeMapList() - Free a float map list.
 //-----------------------------------------------------------------------------
@@ -102,14 +94,60 @@ static void _ctmClearMesh(_CTMcontext * self)
   self->mAttribMapCount = 0;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmCheckIndices() - Check that all indices of an array are below
+// aVertexCount. Blocks of indices are checked without branching per index,
+// so that the compiler can vectorize the inner loop.
+//-----------------------------------------------------------------------------
+static CTMint _ctmCheckIndices(const CTMuint * aIndices, CTMuint aCount,
+  CTMuint aVertexCount)
+{
+  CTMuint i, end, bad;
+
+  for(i = 0; i < aCount; i = end)
+  {
+    end = (aCount - i > 4096) ? i + 4096 : aCount;
+    bad = 0;
+    for(; i < end; ++ i)
+      bad |= (aIndices[i] >= aVertexCount);
+    if(bad)
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckFloats() - Check that all values of an array are finite (non-NaN,
+// non-inf), by blocks like _ctmCheckIndices().
+//-----------------------------------------------------------------------------
+static CTMint _ctmCheckFloats(const CTMfloat * aValues, CTMuint aCount)
+{
+  CTMuint i, end, acc;
+  _CTMfloatbits bits;
+
+  for(i = 0; i < aCount; i = end)
+  {
+    end = (aCount - i > 4096) ? i + 4096 : aCount;
+    acc = 0;
+    for(; i < end; ++ i)
+    {
+      bits.f = aValues[i];
+      acc |= _CTM_NONFINITE_BITS(bits.u);
+    }
+    if(_CTM_NONFINITE(acc))
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmCheckMeshIntegrity() - Check if a mesh is valid (i.e. is non-empty, and
-// contains valid data).
+// contains valid data). The checks in aSkip (_CTM_CHECKED_* bits) are not
+// repeated.
 //-----------------------------------------------------------------------------
 
-static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
+static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self, CTMuint aSkip)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
   // Check that we have all the mandatory data
@@ -120,46 +158,29 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   }
 
   // Check that all indices are within range
-  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  if(!(aSkip & _CTM_CHECKED_INDICES) &&
+     !_ctmCheckIndices(self->mIndices, self->mTriangleCount * 3, self->mVertexCount))
   {
-    if(self->mIndices[i] >= self->mVertexCount)
-    {
-      return CTM_FALSE;
-    }
+    return CTM_FALSE;
   }
 
+  if(aSkip & _CTM_CHECKED_FLOATS)
+    return CTM_TRUE;
+
   // Check that all vertices are finite (non-NaN, non-inf)
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-  {
-    if(!isfinite(self->mVertices[i]))
-    {
-      return CTM_FALSE;
-    }
-  }
+  if(!_ctmCheckFloats(self->mVertices, self->mVertexCount * 3))
+    return CTM_FALSE;
 
   // Check that all normals are finite (non-NaN, non-inf)
-  if(self->mNormals)
-  {
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-    {
-      if(!isfinite(self->mNormals[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
-  }
+  if(self->mNormals && !_ctmCheckFloats(self->mNormals, self->mVertexCount * 3))
+    return CTM_FALSE;
 
   // Check that all UV maps are finite (non-NaN, non-inf)
   map = self->mUVMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-    {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
+    if(!_ctmCheckFloats(map->mValues, self->mVertexCount * 2))
+      return CTM_FALSE;
     map = map->mNext;
   }
 
@@ -167,13 +188,8 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-    {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
+    if(!_ctmCheckFloats(map->mValues, self->mVertexCount * 4))
+      return CTM_FALSE;
     map = map->mNext;
   }
 
@@ -181,27 +197,63 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
 }
 
 //-----------------------------------------------------------------------------
-// ctmNewContext()
+// _ctmInitContext() - Initialize a context with the default settings.
 //-----------------------------------------------------------------------------
-CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
+static void _ctmInitContext(_CTMcontext * self, CTMenum aMode)
 {
-  _CTMcontext * self;
-
-  // Allocate memory for the new structure
-  self = (_CTMcontext *) malloc(sizeof(_CTMcontext));
-
   // Initialize structure (set null pointers and zero array lengths)
   memset(self, 0, sizeof(_CTMcontext));
   self->mMode = aMode;
   self->mError = CTM_NONE;
   self->mMethod = CTM_METHOD_MG1;
   self->mCompressionLevel = 1;
+  self->mCompressionThreads = 1;
+  self->mDecompressionThreads = 1;
+  self->mValidation = CTM_VALIDATE_FULL;
+  self->mLzmaLc = self->mLzmaLp = self->mLzmaPb = -1;
+  self->mLzmaFb = self->mLzmaAlgo = -1;
   self->mVertexPrecision = 1.0f / 1024.0f;
   self->mNormalPrecision = 1.0f / 256.0f;
+}
+
+//-----------------------------------------------------------------------------
+// ctmNewContext()
+//-----------------------------------------------------------------------------
+CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
+{
+  _CTMcontext * self;
+
+  // Allocate memory for the new structure
+  self = (_CTMcontext *) malloc(sizeof(_CTMcontext));
+  if(!self) return (CTMcontext) 0;
+
+  _ctmInitContext(self, aMode);
 
   return (CTMcontext) self;
 }
 
+//-----------------------------------------------------------------------------
+// ctmResetContext()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmResetContext(CTMcontext aContext)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMstreamcache cache;
+  if(!self) return;
+
+  // Free all mesh resources and the file comment
+  _ctmClearMesh(self);
+  if(self->mFileComment)
+    free(self->mFileComment);
+
+  // Restore the default settings, but keep the stream memory (except for
+  // the buffers of unusually large meshes)
+  _ctmStreamTrimCache(self, _CTM_CACHE_MAX_BUFFER_SIZE);
+  cache = self->mStreamCache;
+  _ctmInitContext(self, self->mMode);
+  self->mStreamCache = cache;
+}
+
 //-----------------------------------------------------------------------------
 // ctmFreeContext()
 //-----------------------------------------------------------------------------
@@ -217,6 +269,9 @@ CTMEXPORT void CTMCALL ctmFreeContext(CTMcontext aContext)
   if(self->mFileComment)
     free(self->mFileComment);
 
+  // Free the reused stream memory
+  _ctmStreamFreeCache(self);
+
   // Free the context
   free(self);
 }
@@ -297,6 +352,9 @@ CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
     case CTM_COMPRESSION_METHOD:
       return (CTMuint) self->mMethod;
 
+    case CTM_READ_SIZE:
+      return self->mReadCount;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -320,6 +378,9 @@ CTMEXPORT CTMfloat CTMCALL ctmGetFloat(CTMcontext aContext, CTMenum aProperty)
     case CTM_NORMAL_PRECISION:
       return self->mNormalPrecision;
 
+    case CTM_LZMA_TIME:
+      return (CTMfloat) self->mLzmaTime;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -689,8 +750,113 @@ CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
     return;
   }
 
-  // Set the compression level
+  // Set the compression level, with the LZMA settings of that level
   self->mCompressionLevel = aLevel;
+  self->mLzmaDictSize = 0;
+  self->mLzmaLc = self->mLzmaLp = self->mLzmaPb = -1;
+  self->mLzmaFb = self->mLzmaAlgo = -1;
+}
+
+//-----------------------------------------------------------------------------
+// ctmCompressionPreset()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmCompressionPreset(CTMcontext aContext,
+  CTMenum aPreset)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // The packed arrays are byte planes, which have no 2/4-byte alignment
+  // structure, so the literal position and position bits are always zero.
+  // The match finder decides the encoding time: the hash chain finder of the
+  // fast encode preset is about 3.5x faster than the binary tree finder of
+  // the default level, for ~8% larger output, while the max ratio preset
+  // searches longer matches (fb 273) in a larger dictionary.
+  switch(aPreset)
+  {
+    case CTM_PRESET_FAST_ENCODE:
+      self->mCompressionLevel = 1;
+      self->mLzmaDictSize = 0;
+      self->mLzmaLc = 3;
+      self->mLzmaFb = 32;
+      self->mLzmaAlgo = 0;
+      break;
+
+    case CTM_PRESET_MAX_RATIO:
+      self->mCompressionLevel = 5;
+      self->mLzmaDictSize = 1 << 24;
+      self->mLzmaLc = 3;
+      self->mLzmaFb = 273;
+      self->mLzmaAlgo = 1;
+      break;
+
+    default:
+      self->mError = CTM_INVALID_ARGUMENT;
+      return;
+  }
+  self->mLzmaLp = 0;
+  self->mLzmaPb = 0;
+}
+
+//-----------------------------------------------------------------------------
+// ctmCompressionThreads()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreads)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aThreads < 1)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the number of compression threads
+  self->mCompressionThreads = aThreads;
+}
+
+//-----------------------------------------------------------------------------
+// ctmDecompressionThreads()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmDecompressionThreads(CTMcontext aContext,
+  CTMuint aThreads)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change load settings in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aThreads < 1)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the number of decompression threads
+  self->mDecompressionThreads = aThreads;
 }
 
 //-----------------------------------------------------------------------------
@@ -1170,25 +1336,17 @@ static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoadCustom()
+// _ctmLoadStream() - Load a mesh from the stream of the context (see
+// ctmLoadCustom() and ctmLoadFromMemory()).
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
-  void * aUserData)
+static void _ctmLoadStream(_CTMcontext * self)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMuint formatVersion, flags, method;
-  if(!self) return;
+  CTMuint formatVersion, flags, method, skip;
+  CTMint ok;
 
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
-  {
-    self->mError = CTM_INVALID_OPERATION;
-    return;
-  }
-
-  // Initialize stream
-  self->mReadFn = aReadFn;
-  self->mUserData = aUserData;
+  self->mLzmaTime = 0.0;
+  self->mReadCount = 0;
+  self->mReadOverrun = CTM_FALSE;
 
   // Clear any old mesh arrays
   _ctmClearMesh(self);
@@ -1274,32 +1432,133 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   }
 
   // Uncompress from stream
+  self->mChecked = 0;
   switch(self->mMethod)
   {
     case CTM_METHOD_RAW:
-      _ctmUncompressMesh_RAW(self);
+      ok = _ctmUncompressMesh_RAW(self);
       break;
 
     case CTM_METHOD_MG1:
-      _ctmUncompressMesh_MG1(self);
+      ok = _ctmUncompressMesh_MG1(self);
       break;
 
     case CTM_METHOD_MG2:
-      _ctmUncompressMesh_MG2(self);
+      ok = _ctmUncompressMesh_MG2(self);
       break;
 
     default:
+      ok = CTM_FALSE;
       self->mError = CTM_INTERNAL_ERROR;
   }
+  if(!ok)
+  {
+    if(self->mError == CTM_NONE)
+      self->mError = CTM_INVALID_MESH;
+    return;
+  }
 
-  // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
+  // A memory source that ended early has been read as zeros
+  if(self->mReadOverrun)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return;
+  }
+
+  // Check mesh integrity, except what the decoder has already checked
+  skip = self->mChecked;
+  if(self->mValidation != CTM_VALIDATE_FULL)
+    skip |= _CTM_CHECKED_FLOATS;
+  if(!_ctmCheckMeshIntegrity(self, skip))
   {
     self->mError = CTM_INVALID_MESH;
     return;
   }
 }
 
+//-----------------------------------------------------------------------------
+// ctmLoadCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
+  void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Initialize stream
+  self->mReadFn = aReadFn;
+  self->mUserData = aUserData;
+  self->mReadData = self->mReadEnd = (const unsigned char *) 0;
+
+  _ctmLoadStream(self);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadFromMemory()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aData, CTMuint aSize)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+  if(!aData)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Initialize stream
+  self->mReadFn = (CTMreadfn) 0;
+  self->mUserData = (void *) 0;
+  self->mReadData = (const unsigned char *) aData;
+  self->mReadEnd = self->mReadData + aSize;
+
+  _ctmLoadStream(self);
+
+  // The buffer is not kept
+  self->mReadData = self->mReadEnd = (const unsigned char *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadValidation()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadValidation(CTMcontext aContext, CTMenum aLevel)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change load settings in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if((aLevel != CTM_VALIDATE_FULL) && (aLevel != CTM_VALIDATE_INDICES))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the validation level
+  self->mValidation = aLevel;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmDefaultWrite()
 //-----------------------------------------------------------------------------
@@ -1358,7 +1617,7 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   }
 
   // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
+  if(!_ctmCheckMeshIntegrity(self, 0))
   {
     self->mError = CTM_INVALID_MESH;
     return;
@@ -1367,6 +1626,7 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   // Initialize stream
   self->mWriteFn = aWriteFn;
   self->mUserData = aUserData;
+  self->mLzmaTime = 0.0;
 
   // Determine flags
   flags = 0;
@@ -1401,7 +1661,11 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   _ctmStreamWriteUINT(self, flags);
   _ctmStreamWriteSTRING(self, self->mFileComment);
 
-  // Compress to stream
+  // Compress to stream. With several compression threads, the packed arrays
+  // are collected first and compressed concurrently when the stream is
+  // flushed.
+  if(self->mCompressionThreads > 1 && self->mMethod != CTM_METHOD_RAW)
+    _ctmStreamBeginDeferred(self);
   switch(self->mMethod)
   {
     case CTM_METHOD_RAW:
@@ -1418,6 +1682,8 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
 
     default:
       self->mError = CTM_INTERNAL_ERROR;
-      return;
+      break;
   }
+  if(self->mDeferred)
+    _ctmStreamEndDeferred(self);
 }
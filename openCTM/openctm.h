@@ -225,6 +225,8 @@ typedef enum {
   CTM_NORMAL_PRECISION  = 0x0307, ///< Normal precision - for MG2 (float).
   CTM_COMPRESSION_METHOD = 0x0308, ///< Compression method (integer).
   CTM_FILE_COMMENT      = 0x0309, ///< File comment (string).
+  CTM_LZMA_TIME         = 0x030A, ///< Seconds spent in LZMA by the last load/save (float).
+  CTM_READ_SIZE         = 0x030B, ///< Number of bytes read by the last load (integer).
 
   // UV/attribute map queries
   CTM_NAME              = 0x0501, ///< Unique name (UV/attrib map string).
@@ -250,7 +252,15 @@ typedef enum {
   CTM_ATTRIB_MAP_5      = 0x0804, ///< Per vertex attribute map 5 (float array).
   CTM_ATTRIB_MAP_6      = 0x0805, ///< Per vertex attribute map 6 (float array).
   CTM_ATTRIB_MAP_7      = 0x0806, ///< Per vertex attribute map 7 (float array).
-  CTM_ATTRIB_MAP_8      = 0x0807  ///< Per vertex attribute map 8 (float array).
+  CTM_ATTRIB_MAP_8      = 0x0807, ///< Per vertex attribute map 8 (float array).
+
+  // Compression presets
+  CTM_PRESET_FAST_ENCODE = 0x0901, ///< About 3.5x faster encoding than the default level, for ~8% larger output.
+  CTM_PRESET_MAX_RATIO  = 0x0903, ///< 1-2% smaller output than the default level, at about 3x the encoding time.
+
+  // Load validation levels
+  CTM_VALIDATE_FULL     = 0x0A01, ///< Check index ranges and that all values are finite (default).
+  CTM_VALIDATE_INDICES  = 0x0A02  ///< Only check index ranges (for trusted data).
 } CTMenum;
 
 /// Stream read() function pointer.
@@ -280,6 +290,17 @@ typedef CTMuint (CTMCALL * CTMwritefn)(const void * aBuf, CTMuint aCount, void *
 /// @return An OpenCTM context handle (or NULL if no context could be created).
 CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode);
 
+/// Reset an OpenCTM context to the state of a new context of the same mode
+/// (no mesh, default settings), but keep the memory it has allocated for
+/// decoding (LZMA decoder state and array buffers). Loading many meshes with
+/// one context that is reset in between avoids most of the allocations of
+/// ctmNewContext(), ctmLoadCustom() and ctmFreeContext() for every mesh.
+/// Array buffers larger than 4 MB are freed, so that the memory kept by a
+/// long-lived context is bounded whatever the largest mesh it loaded.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+CTMEXPORT void CTMCALL ctmResetContext(CTMcontext aContext);
+
 /// Free an OpenCTM context.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
@@ -471,6 +492,43 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
   CTMuint aLevel);
 
+/// Select a compression preset for the given OpenCTM context. A preset sets
+/// the compression level as well as the LZMA encoder settings (dictionary
+/// size, literal context/position bits, position bits, fast bytes and match
+/// finder algorithm), tuned for the byte plane layout of the packed OpenCTM
+/// arrays. Calling ctmCompressionLevel() afterwards reverts to the plain
+/// settings of that level. The presets trade encoding time for output size;
+/// decoding speed is the same for all of them (within ~10%), as it is bound by
+/// the number of LZMA coded symbols rather than by the encoder settings.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aPreset Which preset to use (CTM_PRESET_FAST_ENCODE or
+///            CTM_PRESET_MAX_RATIO).
+CTMEXPORT void CTMCALL ctmCompressionPreset(CTMcontext aContext,
+  CTMenum aPreset);
+
+/// Set how many threads to use for compressing the mesh arrays of the given
+/// OpenCTM context. With more than one thread, the independent arrays of a
+/// mesh (vertices, indices, normals, UV maps etc) are LZMA compressed
+/// concurrently, which requires memory for all of them at once. The output is
+/// identical regardless of the number of threads. The default is 1.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreads Maximum number of threads to use (1 or more).
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreads);
+
+/// Set how many threads to use for loading a mesh with the given OpenCTM
+/// context. With more than one thread, the smooth normals that MG2 normals
+/// are restored from are calculated concurrently for meshes of 64K triangles
+/// or more. The loaded mesh is identical regardless of the number of threads.
+/// The default is 1.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreads Maximum number of threads to use (1 or more).
+CTMEXPORT void CTMCALL ctmDecompressionThreads(CTMcontext aContext,
+  CTMuint aThreads);
+
 /// Set the vertex coordinate precision (only used by the MG2 compression
 /// method).
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -622,6 +680,31 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName);
 CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   void * aUserData);
 
+/// Load an OpenCTM format file from a memory buffer. This is faster than
+/// ctmLoadCustom() with a reading function, as header fields are read in
+/// place and the LZMA compressed arrays are decompressed straight from the
+/// buffer, without copying them first. The buffer is only used during the
+/// call. A file that is cut short fails with CTM_BAD_FORMAT; trailing data
+/// after the file is ignored (see CTM_READ_SIZE).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aData Pointer to the file data.
+/// @param[in] aSize Size of the file data, in bytes.
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aData, CTMuint aSize);
+
+/// Set how thoroughly a loaded mesh is validated. With CTM_VALIDATE_FULL, the
+/// default, a mesh with an out of range index or with an infinite or NaN
+/// value is rejected with CTM_INVALID_MESH. With CTM_VALIDATE_INDICES, only
+/// the indices are checked, which skips a pass over every float array of RAW
+/// and MG1 files. MG2 files are checked while the arrays are restored, so the
+/// level makes little difference in load time for them.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aLevel Validation level (CTM_VALIDATE_FULL or
+///            CTM_VALIDATE_INDICES).
+CTMEXPORT void CTMCALL ctmLoadValidation(CTMcontext aContext, CTMenum aLevel);
+
 /// Save an OpenCTM format file. The mesh must have been defined by
 /// ctmDefineMesh().
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -111,6 +111,12 @@ class CTMimporter {
       ctmFreeContext(mContext);
     }
 
+    /// Wrapper for ctmResetContext()
+    void Reset()
+    {
+      ctmResetContext(mContext);
+    }
+
     /// Wrapper for ctmGetInteger()
     CTMuint GetInteger(CTMenum aProperty)
     {
@@ -213,6 +219,27 @@ class CTMimporter {
       CheckError();
     }
 
+    /// Wrapper for ctmLoadFromMemory()
+    void LoadFromMemory(const void * aData, CTMuint aSize)
+    {
+      ctmLoadFromMemory(mContext, aData, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmDecompressionThreads()
+    void DecompressionThreads(CTMuint aThreads)
+    {
+      ctmDecompressionThreads(mContext, aThreads);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadValidation()
+    void LoadValidation(CTMenum aLevel)
+    {
+      ctmLoadValidation(mContext, aLevel);
+      CheckError();
+    }
+
     // You can not copy nor assign from one CTMimporter object to another, since
     // the object contains hidden state. By declaring these dummy prototypes
     // without an implementation, you will at least get linker errors if you try
@@ -281,6 +308,20 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmCompressionPreset()
+    void CompressionPreset(CTMenum aPreset)
+    {
+      ctmCompressionPreset(mContext, aPreset);
+      CheckError();
+    }
+
+    /// Wrapper for ctmCompressionThreads()
+    void CompressionThreads(CTMuint aThreads)
+    {
+      ctmCompressionThreads(mContext, aThreads);
+      CheckError();
+    }
+
     /// Wrapper for ctmVertexPrecision()
     void VertexPrecision(CTMfloat aPrecision)
     {
@@ -28,22 +28,67 @@
 #include <stdlib.h>
 #include <string.h>
 #include <LzmaLib.h>
+#include <LzmaDec.h>
 #include "openctm.h"
 #include "internal.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
 #ifdef __DEBUG_
 #include <stdio.h>
 #endif
 
+//-----------------------------------------------------------------------------
+// _ctmClock() - Monotonic wall clock time in seconds (for the LZMA timing).
+//-----------------------------------------------------------------------------
+static double _ctmClock(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double) count.QuadPart / (double) frequency.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamRead() - Read data from a stream.
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount)
 {
+  CTMuint count;
+
+  // Memory source? Copy, and read past its end as zeros
+  if(self->mReadData)
+  {
+    count = aCount;
+    if((size_t) (self->mReadEnd - self->mReadData) < count)
+    {
+      count = (CTMuint) (self->mReadEnd - self->mReadData);
+      memset((unsigned char *) aBuf + count, 0, aCount - count);
+      self->mReadOverrun = CTM_TRUE;
+    }
+    memcpy(aBuf, self->mReadData, count);
+    self->mReadData += count;
+    self->mReadCount += count;
+    return count;
+  }
+
   if(!self->mUserData || !self->mReadFn)
     return 0;
 
-  return self->mReadFn(aBuf, aCount, self->mUserData);
+  count = self->mReadFn(aBuf, aCount, self->mUserData);
+  self->mReadCount += count;
+  return count;
 }
 
 //-----------------------------------------------------------------------------
@@ -51,9 +96,51 @@ CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount)
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
 {
+  _CTMstreamchunk * chunk;
+  unsigned char * data;
+  CTMuint capacity;
+
   if(!self->mUserData || !self->mWriteFn)
     return 0;
 
+  // Deferred stream? Append the data to the last raw chunk
+  if(self->mDeferred)
+  {
+    chunk = self->mLastChunk;
+    if(!chunk || chunk->mPack)
+    {
+      chunk = (_CTMstreamchunk *) malloc(sizeof(_CTMstreamchunk));
+      if(!chunk)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        return 0;
+      }
+      memset(chunk, 0, sizeof(_CTMstreamchunk));
+      if(self->mLastChunk)
+        self->mLastChunk->mNext = chunk;
+      else
+        self->mFirstChunk = chunk;
+      self->mLastChunk = chunk;
+    }
+    if(chunk->mSize + aCount > chunk->mCapacity)
+    {
+      capacity = 2 * (chunk->mSize + aCount);
+      if(capacity < 256)
+        capacity = 256;
+      data = (unsigned char *) realloc(chunk->mData, capacity);
+      if(!data)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        return 0;
+      }
+      chunk->mData = data;
+      chunk->mCapacity = capacity;
+    }
+    memcpy(&chunk->mData[chunk->mSize], aBuf, aCount);
+    chunk->mSize += aCount;
+    return aCount;
+  }
+
   return self->mWriteFn(aBuf, aCount, self->mUserData);
 }
 
@@ -64,6 +151,19 @@ CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
 CTMuint _ctmStreamReadUINT(_CTMcontext * self)
 {
   unsigned char buf[4];
+  const unsigned char * p = self->mReadData;
+
+  // Read in place from a memory source
+  if(p && ((self->mReadEnd - p) >= 4))
+  {
+    self->mReadData += 4;
+    self->mReadCount += 4;
+    return ((CTMuint) p[0]) |
+           (((CTMuint) p[1]) << 8) |
+           (((CTMuint) p[2]) << 16) |
+           (((CTMuint) p[3]) << 24);
+  }
+
   _ctmStreamRead(self, (void *) buf, 4);
   return ((CTMuint) buf[0]) |
          (((CTMuint) buf[1]) << 8) |
@@ -168,18 +268,134 @@ void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
-// from a stream, and uncompress it.
+// _ctmLzmaAlloc - Allocator of the LZMA decoder probability tables.
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static void * _ctmLzmaAllocFn(void * p, size_t size)
+{
+  (void) p;
+  return malloc(size);
+}
+
+static void _ctmLzmaFreeFn(void * p, void * address)
+{
+  (void) p;
+  free(address);
+}
+
+static ISzAlloc _ctmLzmaAlloc = { _ctmLzmaAllocFn, _ctmLzmaFreeFn };
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBuffer() - Get reused buffer aIdx (_CTM_BUFFER_*), with room for
+// at least aSize bytes. Its previous content is lost if it has to grow.
+//-----------------------------------------------------------------------------
+void * _ctmStreamBuffer(_CTMcontext * self, CTMuint aIdx, size_t aSize)
+{
+  _CTMstreamcache * cache = &self->mStreamCache;
+
+  if(!cache->mBuffers[aIdx] || (cache->mBufferSizes[aIdx] < aSize))
+  {
+    if(cache->mBuffers[aIdx])
+      free(cache->mBuffers[aIdx]);
+    cache->mBuffers[aIdx] = (unsigned char *) malloc(aSize ? aSize : 1);
+    cache->mBufferSizes[aIdx] = cache->mBuffers[aIdx] ? aSize : 0;
+  }
+  return cache->mBuffers[aIdx];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzmaUncompress() - Uncompress an LZMA stream (like LzmaUncompress()),
+// with the decoder state of the context. Its probability tables are only
+// reallocated when the lc + lp props differ from the previous stream.
+//-----------------------------------------------------------------------------
+static int _ctmLzmaUncompress(_CTMcontext * self, unsigned char * aDest,
+  size_t * aDestLen, const unsigned char * aSrc, size_t * aSrcLen,
+  const unsigned char * aProps)
+{
+  CLzmaDec * decoder;
+  ELzmaStatus status;
+  SizeT inSize = *aSrcLen, outSize = *aDestLen;
+  SRes res;
+
+  *aSrcLen = *aDestLen = 0;
+  decoder = (CLzmaDec *) self->mStreamCache.mLzmaDecoder;
+  if(!decoder)
+  {
+    decoder = (CLzmaDec *) malloc(sizeof(CLzmaDec));
+    if(!decoder)
+      return SZ_ERROR_MEM;
+    LzmaDec_Construct(decoder);
+    self->mStreamCache.mLzmaDecoder = decoder;
+  }
+  res = LzmaDec_AllocateProbs(decoder, aProps, LZMA_PROPS_SIZE, &_ctmLzmaAlloc);
+  if(res != SZ_OK)
+    return res;
+
+  // Decode directly into the destination, which serves as the dictionary
+  decoder->dic = aDest;
+  decoder->dicBufSize = outSize;
+  LzmaDec_Init(decoder);
+  *aSrcLen = inSize;
+  res = LzmaDec_DecodeToDic(decoder, outSize, aSrc, aSrcLen, LZMA_FINISH_ANY, &status);
+  if((res == SZ_OK) && (status == LZMA_STATUS_NEEDS_MORE_INPUT))
+    res = SZ_ERROR_INPUT_EOF;
+  *aDestLen = decoder->dicPos;
+  decoder->dic = (Byte *) 0;
+
+  return res;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamFreeCache() - Free the memory that the stream reuses.
+//-----------------------------------------------------------------------------
+void _ctmStreamFreeCache(_CTMcontext * self)
+{
+  _CTMstreamcache * cache = &self->mStreamCache;
+  CTMuint i;
+
+  if(cache->mLzmaDecoder)
+  {
+    LzmaDec_FreeProbs((CLzmaDec *) cache->mLzmaDecoder, &_ctmLzmaAlloc);
+    free(cache->mLzmaDecoder);
+  }
+  for(i = 0; i < _CTM_BUFFER_COUNT; ++ i)
+    if(cache->mBuffers[i])
+      free(cache->mBuffers[i]);
+  memset(cache, 0, sizeof(_CTMstreamcache));
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamTrimCache() - Free the reused buffers larger than aMaxSize bytes.
+//-----------------------------------------------------------------------------
+void _ctmStreamTrimCache(_CTMcontext * self, size_t aMaxSize)
+{
+  _CTMstreamcache * cache = &self->mStreamCache;
+  CTMuint i;
+
+  for(i = 0; i < _CTM_BUFFER_COUNT; ++ i)
+  {
+    if(cache->mBuffers[i] && (cache->mBufferSizes[i] > aMaxSize))
+    {
+      free(cache->mBuffers[i]);
+      cache->mBuffers[i] = (unsigned char *) 0;
+      cache->mBufferSizes[i] = 0;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPacked() - Read an LZMA compressed array from a stream, and
+// uncompress it into a reused stream buffer, which is returned (or NULL on
+// failure).
+//-----------------------------------------------------------------------------
+static unsigned char * _ctmStreamReadPacked(_CTMcontext * self,
+  size_t aUnpackedSize)
 {
   size_t packedSize, unpackedSize;
-  CTMuint i, k, x;
-  CTMint value;
-  unsigned char * packed, * tmp;
+  const unsigned char * packed;
+  unsigned char * tmp;
   unsigned char props[5];
   int lzmaRes;
+  double startTime;
 
   // Read packed data size from the stream
   packedSize = (size_t) _ctmStreamReadUINT(self);
@@ -187,40 +403,73 @@ int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
   // Read LZMA compression props from the stream
   _ctmStreamRead(self, (void *) props, 5);
 
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
+  // Read the packed data from the stream (in place from a memory source,
+  // whose size bounds the packed size before anything is allocated)
+  if(self->mReadData)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    if((size_t) (self->mReadEnd - self->mReadData) < packedSize)
+    {
+      self->mReadOverrun = CTM_TRUE;
+      self->mError = CTM_BAD_FORMAT;
+      return (unsigned char *) 0;
+    }
+    packed = self->mReadData;
+    self->mReadData += packedSize;
+    self->mReadCount += (CTMuint) packedSize;
+  }
+  else
+  {
+    tmp = (unsigned char *) _ctmStreamBuffer(self, _CTM_BUFFER_PACKED, packedSize);
+    if(!tmp)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (unsigned char *) 0;
+    }
+    _ctmStreamRead(self, (void *) tmp, packedSize);
+    packed = tmp;
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
+  // Get memory for the interleaved array
+  tmp = (unsigned char *) _ctmStreamBuffer(self, _CTM_BUFFER_UNPACKED, aUnpackedSize);
   if(!tmp)
   {
-    free(packed);
     self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    return (unsigned char *) 0;
   }
 
   // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
-
-  // Free the packed array
-  free(packed);
+  unpackedSize = aUnpackedSize;
+  startTime = _ctmClock();
+  lzmaRes = _ctmLzmaUncompress(self, tmp, &unpackedSize, packed,
+                               &packedSize, props);
+  self->mLzmaTime += _ctmClock() - startTime;
 
   // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  if((lzmaRes != SZ_OK) || (unpackedSize != aUnpackedSize))
   {
     self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
+    return (unsigned char *) 0;
   }
 
+  return tmp;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
+// from a stream, and uncompress it.
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  CTMuint i, k, x;
+  CTMint value;
+  unsigned char * tmp;
+
+  // Read and uncompress the interleaved array
+  tmp = _ctmStreamReadPacked(self, (size_t) aCount * aSize * 4);
+  if(!tmp)
+    return CTM_FALSE;
+
   // Convert interleaved array to integers
   for(i = 0; i < aCount; ++ i)
   {
@@ -240,10 +489,132 @@ int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
     }
   }
 
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackChunk() - LZMA compress the interleaved array of a chunk.
+//-----------------------------------------------------------------------------
+static void _ctmPackChunk(_CTMcontext * self, _CTMstreamchunk * aChunk)
+{
+  size_t bufSize, outPropsSize;
+  int lzmaAlgo;
+  double startTime;
+
+  // Allocate memory for the packed data
+  bufSize = 1000 + aChunk->mSize;
+  aChunk->mPacked = (unsigned char *) malloc(bufSize);
+  if(!aChunk->mPacked)
+  {
+    aChunk->mLzmaRes = SZ_ERROR_MEM;
+    return;
+  }
+
+  // Call LZMA to compress
+  outPropsSize = 5;
+  startTime = _ctmClock();
+  lzmaAlgo = self->mLzmaAlgo;
+  if(lzmaAlgo < 0)
+    lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
+  aChunk->mLzmaRes = LzmaCompress(aChunk->mPacked,
+                                  &bufSize,
+                                  (const unsigned char *) aChunk->mData,
+                                  aChunk->mSize,
+                                  aChunk->mProps,
+                                  &outPropsSize,
+                                  self->mCompressionLevel, // Level (0-9)
+                                  self->mLzmaDictSize,     // Dictionary size (0 = set by level)
+                                  self->mLzmaLc,           // Literal context bits (-1 = default)
+                                  self->mLzmaLp,           // Literal position bits (-1 = default)
+                                  self->mLzmaPb,           // Position bits (-1 = default)
+                                  self->mLzmaFb,           // Fast bytes (-1 = set by level)
+                                  -1,                      // Threads (default)
+                                  lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
+                                 );
+  aChunk->mPackedSize = (CTMuint) bufSize;
+  aChunk->mLzmaTime = _ctmClock() - startTime;
+
   // Free the interleaved array
-  free(tmp);
+  free(aChunk->mData);
+  aChunk->mData = (unsigned char *) 0;
+}
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmWritePackedChunk() - Write a compressed chunk to the stream, and free
+// its packed data.
+//-----------------------------------------------------------------------------
+static int _ctmWritePackedChunk(_CTMcontext * self, _CTMstreamchunk * aChunk)
+{
+  int result = CTM_TRUE;
+
+  self->mLzmaTime += aChunk->mLzmaTime;
+
+  // Error?
+  if(aChunk->mLzmaRes != SZ_OK)
+  {
+    self->mError = (aChunk->mLzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
+    result = CTM_FALSE;
+  }
+  else
+  {
+#ifdef __DEBUG_
+    printf("%d->%d bytes\n", aChunk->mSize, aChunk->mPackedSize);
+#endif
+
+    // Write packed data size to the stream
+    _ctmStreamWriteUINT(self, aChunk->mPackedSize);
+
+    // Write LZMA compression props to the stream
+    _ctmStreamWrite(self, (void *) aChunk->mProps, 5);
+
+    // Write the packed data to the stream
+    _ctmStreamWrite(self, (void *) aChunk->mPacked, aChunk->mPackedSize);
+  }
+
+  // Free the packed data
+  if(aChunk->mPacked)
+    free(aChunk->mPacked);
+  aChunk->mPacked = (unsigned char *) 0;
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePacked() - Compress an interleaved array and write it to the
+// stream. The array is owned (and freed) by this function. For a deferred
+// stream, compression is postponed until the stream is flushed.
+//-----------------------------------------------------------------------------
+static int _ctmStreamWritePacked(_CTMcontext * self, unsigned char * aData,
+  CTMuint aSize)
+{
+  _CTMstreamchunk * chunk, local;
+
+  if(self->mDeferred)
+  {
+    chunk = (_CTMstreamchunk *) malloc(sizeof(_CTMstreamchunk));
+    if(!chunk)
+    {
+      free(aData);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    memset(chunk, 0, sizeof(_CTMstreamchunk));
+    chunk->mData = aData;
+    chunk->mSize = aSize;
+    chunk->mPack = CTM_TRUE;
+    if(self->mLastChunk)
+      self->mLastChunk->mNext = chunk;
+    else
+      self->mFirstChunk = chunk;
+    self->mLastChunk = chunk;
+    return CTM_TRUE;
+  }
+
+  memset(&local, 0, sizeof(_CTMstreamchunk));
+  local.mData = aData;
+  local.mSize = aSize;
+  _ctmPackChunk(self, &local);
+  return _ctmWritePackedChunk(self, &local);
 }
 
 //-----------------------------------------------------------------------------
@@ -253,11 +624,9 @@ int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
 int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
   CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
 {
-  int lzmaRes, lzmaAlgo;
   CTMuint i, k;
   CTMint value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
+  unsigned char * tmp;
 #ifdef __DEBUG_
   CTMuint negCount = 0;  
 #endif
@@ -290,58 +659,11 @@ int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
     }
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
-  {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
-
-  // Error?
-  if(lzmaRes != SZ_OK)
-  {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
-    return CTM_FALSE;
-  }
-
 #ifdef __DEBUG_
-  printf("%d->%d bytes (%d negative words)\n", aCount * aSize * 4, (int) bufSize, negCount);
+  printf("(%d negative words) ", negCount);
 #endif
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
-
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
-
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
-
-  // Free the packed data
-  free(packed);
-
-  return CTM_TRUE;
+  return _ctmStreamWritePacked(self, tmp, aCount * aSize * 4);
 }
 
 //-----------------------------------------------------------------------------
@@ -352,54 +674,16 @@ int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
   CTMuint aCount, CTMuint aSize)
 {
   CTMuint i, k;
-  size_t packedSize, unpackedSize;
   union {
     CTMfloat f;
     CTMint i;
   } value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
-
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
+  unsigned char * tmp;
 
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
-
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-  _ctmStreamRead(self, (void *) packed, packedSize);
-
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
+  // Read and uncompress the interleaved array
+  tmp = _ctmStreamReadPacked(self, (size_t) aCount * aSize * 4);
   if(!tmp)
-  {
-    free(packed);
-    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
-  }
-
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
-
-  // Free the packed array
-  free(packed);
-
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
-  {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
-  }
 
   // Convert interleaved array to floats
   for(i = 0; i < aCount; ++ i)
@@ -414,9 +698,6 @@ int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
     }
   }
 
-  // Free the interleaved array
-  free(tmp);
-
   return CTM_TRUE;
 }
 
@@ -427,14 +708,12 @@ int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
 int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
   CTMuint aCount, CTMuint aSize)
 {
-  int lzmaRes, lzmaAlgo;
   CTMuint i, k;
   union {
     CTMfloat f;
     CTMint i;
   } value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
+  unsigned char * tmp;
 
   // Allocate memory for interleaved array
   tmp = (unsigned char *) malloc(aCount * aSize * 4);
@@ -457,56 +736,191 @@ int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
     }
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+  return _ctmStreamWritePacked(self, tmp, aCount * aSize * 4);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMpackqueue - Queue of chunks that are compressed by a pool of threads.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMstreamchunk ** mChunks;
+  CTMuint mCount;
+  CTMuint mNext;
+  _CTMcontext * mContext;
+#ifdef _WIN32
+  CRITICAL_SECTION mMutex;
+#else
+  pthread_mutex_t mMutex;
+#endif
+} _CTMpackqueue;
+
+//-----------------------------------------------------------------------------
+// _ctmPackWorker() - Compress chunks from the queue until it is empty.
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI _ctmPackWorker(LPVOID aQueue)
+#else
+static void * _ctmPackWorker(void * aQueue)
+#endif
+{
+  _CTMpackqueue * queue = (_CTMpackqueue *) aQueue;
+  CTMuint idx;
+
+  for(;;)
   {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+#ifdef _WIN32
+    EnterCriticalSection(&queue->mMutex);
+    idx = queue->mNext ++;
+    LeaveCriticalSection(&queue->mMutex);
+#else
+    pthread_mutex_lock(&queue->mMutex);
+    idx = queue->mNext ++;
+    pthread_mutex_unlock(&queue->mMutex);
+#endif
+    if(idx >= queue->mCount)
+      break;
+    _ctmPackChunk(queue->mContext, queue->mChunks[idx]);
   }
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
+  return 0;
+}
 
-  // Error?
-  if(lzmaRes != SZ_OK)
+//-----------------------------------------------------------------------------
+// _ctmPackChunks() - Compress all packed chunks of a deferred stream, using
+// up to self->mCompressionThreads threads (including the calling thread). The
+// largest chunks are started first.
+//-----------------------------------------------------------------------------
+static int _ctmPackChunks(_CTMcontext * self)
+{
+  _CTMpackqueue queue;
+  _CTMstreamchunk * chunk;
+  CTMuint i, j, threadCount;
+#ifdef _WIN32
+  HANDLE * threads;
+#else
+  pthread_t * threads;
+#endif
+
+  // Gather the chunks to compress, sorted by decreasing size
+  memset(&queue, 0, sizeof(_CTMpackqueue));
+  queue.mContext = self;
+  for(chunk = self->mFirstChunk; chunk; chunk = chunk->mNext)
+    if(chunk->mPack)
+      ++ queue.mCount;
+  if(!queue.mCount)
+    return CTM_TRUE;
+  queue.mChunks = (_CTMstreamchunk **) malloc(sizeof(_CTMstreamchunk *) * queue.mCount);
+  if(!queue.mChunks)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
+    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
+  i = 0;
+  for(chunk = self->mFirstChunk; chunk; chunk = chunk->mNext)
+  {
+    if(!chunk->mPack)
+      continue;
+    for(j = i; j > 0 && queue.mChunks[j - 1]->mSize < chunk->mSize; -- j)
+      queue.mChunks[j] = queue.mChunks[j - 1];
+    queue.mChunks[j] = chunk;
+    ++ i;
+  }
 
-#ifdef __DEBUG_
-  printf("%d->%d bytes\n", aCount * aSize * 4, (int) bufSize);
+  // Start the worker threads. If a thread can not be started, the remaining
+  // chunks are simply compressed by fewer threads.
+  threadCount = self->mCompressionThreads - 1;
+  if(threadCount > queue.mCount - 1)
+    threadCount = queue.mCount - 1;
+  threads = 0;
+  if(threadCount)
+    threads = malloc(sizeof(*threads) * threadCount);
+  if(!threads)
+    threadCount = 0;
+#ifdef _WIN32
+  InitializeCriticalSection(&queue.mMutex);
+  for(i = 0; i < threadCount; ++ i)
+  {
+    threads[i] = CreateThread(NULL, 0, _ctmPackWorker, &queue, 0, NULL);
+    if(!threads[i])
+      break;
+  }
+#else
+  pthread_mutex_init(&queue.mMutex, NULL);
+  for(i = 0; i < threadCount; ++ i)
+  {
+    if(pthread_create(&threads[i], NULL, _ctmPackWorker, &queue) != 0)
+      break;
+  }
 #endif
+  threadCount = i;
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+  // Work on the queue from this thread too, then wait for the workers
+  _ctmPackWorker(&queue);
+#ifdef _WIN32
+  for(i = 0; i < threadCount; ++ i)
+  {
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+  }
+  DeleteCriticalSection(&queue.mMutex);
+#else
+  for(i = 0; i < threadCount; ++ i)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&queue.mMutex);
+#endif
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+  if(threads)
+    free((void *) threads);
+  free((void *) queue.mChunks);
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBeginDeferred() - Start collecting the stream output in memory,
+// so that the packed arrays of a mesh can be compressed concurrently when the
+// stream is flushed with _ctmStreamEndDeferred().
+//-----------------------------------------------------------------------------
+void _ctmStreamBeginDeferred(_CTMcontext * self)
+{
+  self->mDeferred = CTM_TRUE;
+  self->mFirstChunk = (_CTMstreamchunk *) 0;
+  self->mLastChunk = (_CTMstreamchunk *) 0;
+}
 
-  // Free the packed data
-  free(packed);
+//-----------------------------------------------------------------------------
+// _ctmStreamEndDeferred() - Compress the pending chunks and write them to the
+// stream, in order. The output is identical to that of a non-deferred stream.
+// If an error has occured, nothing is written.
+//-----------------------------------------------------------------------------
+int _ctmStreamEndDeferred(_CTMcontext * self)
+{
+  _CTMstreamchunk * chunk, * next;
+  int result;
 
-  return CTM_TRUE;
+  self->mDeferred = CTM_FALSE;
+
+  result = (self->mError == CTM_NONE) && _ctmPackChunks(self);
+
+  // Write (and free) all chunks
+  for(chunk = self->mFirstChunk; chunk; chunk = next)
+  {
+    next = chunk->mNext;
+    if(result)
+    {
+      if(chunk->mPack)
+        result = _ctmWritePackedChunk(self, chunk);
+      else
+        _ctmStreamWrite(self, (void *) chunk->mData, chunk->mSize);
+    }
+    if(chunk->mData)
+      free(chunk->mData);
+    if(chunk->mPacked)
+      free(chunk->mPacked);
+    free(chunk);
+  }
+  self->mFirstChunk = (_CTMstreamchunk *) 0;
+  self->mLastChunk = (_CTMstreamchunk *) 0;
+
+  return result;
 }
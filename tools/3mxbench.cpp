@@ -0,0 +1,312 @@
+// Load benchmark of the 3mx plugin. Reads every tile of a dataset through
+// osgDB, with a configurable number of threads, and reports the per-stage
+// load timings of the plugin, tile load time percentiles, tiles per second
+// and the peak resident set size.
+//
+// usage: 3mxbench [-t threads] [-r repeat] [-O "plugin options"] <file.3mx|file.3mxb|directory>
+//
+// A .3mx or .3mxb is walked through the file children of its PagedLODs, a
+// directory is searched recursively for .3mxb tiles.
+
+#include <osg/NodeVisitor>
+#include <osg/PagedLOD>
+#include <osg/Timer>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReadFile>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Stats3MX.h"
+
+namespace
+{
+	// A tile to load, with the database options of its PagedLOD if any, like
+	// the database pager.
+	struct TileRequest
+	{
+		std::string file;
+		osg::ref_ptr<const osgDB::Options> options;
+	};
+
+	class ChildFilesVisitor : public osg::NodeVisitor
+	{
+	public:
+		ChildFilesVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+		virtual void apply(osg::PagedLOD& plod)
+		{
+			for (unsigned int i = 0; i < plod.getNumFileNames(); ++i)
+			{
+				if (plod.getFileName(i).empty()) continue;
+				TileRequest request;
+				request.file = plod.getDatabasePath() + plod.getFileName(i);
+				request.options = dynamic_cast<const osgDB::Options*>(plod.getDatabaseOptions());
+				files.push_back(request);
+			}
+			traverse(plod);
+		}
+
+		std::vector<TileRequest> files;
+	};
+
+	void findTiles(const std::string& dir, std::vector<std::string>& files)
+	{
+		osgDB::DirectoryContents contents = osgDB::getDirectoryContents(dir);
+		std::sort(contents.begin(), contents.end());
+		for (auto& name : contents)
+		{
+			if (name == "." || name == "..") continue;
+			std::string path = osgDB::concatPaths(dir, name);
+			if (osgDB::fileType(path) == osgDB::DIRECTORY) findTiles(path, files);
+			else if (osgDB::getLowerCaseFileExtension(name) == "3mxb") files.push_back(path);
+		}
+	}
+
+	double peakRSSMegabytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0.0;
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage)) return 0.0;
+#ifdef __APPLE__
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+		return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+	}
+
+	double percentile(const std::vector<double>& sorted, double p)
+	{
+		if (sorted.empty()) return 0.0;
+		size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(i, sorted.size() - 1)];
+	}
+
+	double totalSeconds(const TileStats3MX& tile)
+	{
+		double seconds = 0.0;
+		for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i) seconds += tile.seconds[i];
+		return seconds;
+	}
+
+	// Keeps the records of the slowest tiles.
+	class SlowestTiles : public TileStatsCallback3MX
+	{
+	public:
+		SlowestTiles(size_t count) : _count(count) {}
+
+		virtual void tileRead(const TileStats3MX& tile)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			tiles.push_back(tile);
+			std::sort(tiles.begin(), tiles.end(), [](const TileStats3MX& a, const TileStats3MX& b) { return totalSeconds(a) > totalSeconds(b); });
+			if (tiles.size() > _count) tiles.pop_back();
+		}
+
+		std::vector<TileStats3MX> tiles;
+
+	private:
+		size_t _count;
+		std::mutex _mutex;
+	};
+
+	// Loads tiles from a shared queue. When walking, the file children of every
+	// loaded tile are queued too.
+	class Loader
+	{
+	public:
+		Loader(const osgDB::Options* options, bool walk) : _options(options), _walk(walk), _busy(0), _failed(0) {}
+
+		void add(const std::string& file)
+		{
+			TileRequest request;
+			request.file = file;
+			_queue.push_back(request);
+		}
+
+		void run(unsigned int threadsNum)
+		{
+			std::vector<std::thread> threads;
+			for (unsigned int i = 1; i < threadsNum; ++i)
+			{
+				threads.push_back(std::thread(&Loader::work, this));
+			}
+			work();
+			for (auto& thread : threads)
+			{
+				thread.join();
+			}
+		}
+
+		std::vector<double> times;
+		unsigned int failed() const { return _failed; }
+
+	private:
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true)
+			{
+				// other threads may still queue children while busy
+				_condition.wait(lock, [this]() { return !_queue.empty() || !_busy; });
+				if (_queue.empty()) break;
+
+				TileRequest request = _queue.front();
+				_queue.pop_front();
+				++_busy;
+				lock.unlock();
+
+				osg::Timer_t start = osg::Timer::instance()->tick();
+				osg::ref_ptr<osg::Node> node = osgDB::readRefNodeFile(request.file, request.options.valid() ? request.options.get() : _options.get());
+				double seconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+
+				ChildFilesVisitor visitor;
+				if (node.valid() && _walk) node->accept(visitor);
+
+				lock.lock();
+				--_busy;
+				if (node.valid())
+				{
+					times.push_back(seconds);
+					_queue.insert(_queue.end(), visitor.files.begin(), visitor.files.end());
+				}
+				else
+				{
+					std::cerr << "Reading " << request.file << " failed." << std::endl;
+					++_failed;
+				}
+				_condition.notify_all();
+			}
+		}
+
+		osg::ref_ptr<const osgDB::Options> _options;
+		bool _walk;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		std::deque<TileRequest> _queue;
+		unsigned int _busy;
+		unsigned int _failed;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	unsigned int threadsNum = 1;
+	unsigned int repeat = 1;
+	std::string optionString;
+	std::string path;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc) threadsNum = std::max(1, atoi(argv[++i]));
+		else if (arg == "-r" && i + 1 < argc) repeat = std::max(1, atoi(argv[++i]));
+		else if (arg == "-O" && i + 1 < argc) optionString = argv[++i];
+		else if (path.empty() && arg[0] != '-') path = arg;
+		else
+		{
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " [-t threads] [-r repeat] [-O \"plugin options\"] <file.3mx|file.3mxb|directory>" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> files;
+	bool walk = osgDB::fileType(path) != osgDB::DIRECTORY;
+	if (walk) files.push_back(path);
+	else findTiles(path, files);
+	if (files.empty())
+	{
+		std::cerr << "No tile found in " << path << std::endl;
+		return 1;
+	}
+
+	LoadStats3MX stats;
+	SlowestTiles slowestTiles(5);
+	stats.callback = &slowestTiles;
+	osg::ref_ptr<osgDB::Options> options = new osgDB::Options(optionString);
+	options->setObjectCacheHint(osgDB::Options::CACHE_NONE);
+	options->setPluginData(LoadStats3MX::pluginDataName(), &stats);
+
+	std::vector<double> times;
+	unsigned int failed = 0;
+	osg::Timer_t start = osg::Timer::instance()->tick();
+	for (unsigned int i = 0; i < repeat; ++i)
+	{
+		Loader loader(options.get(), walk);
+		for (auto& file : files) loader.add(file);
+		loader.run(threadsNum);
+		times.insert(times.end(), loader.times.begin(), loader.times.end());
+		failed += loader.failed();
+	}
+	double wallSeconds = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+	options->removePluginData(LoadStats3MX::pluginDataName());
+
+	std::sort(times.begin(), times.end());
+	double loadSeconds = 0.0;
+	for (auto t : times) loadSeconds += t;
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "tiles:      " << times.size() << " loaded, " << failed << " failed, " << threadsNum << " threads, " << repeat << " passes" << std::endl;
+	std::cout << "wall time:  " << wallSeconds << " s, " << (wallSeconds > 0.0 ? times.size() / wallSeconds : 0.0) << " tiles/s" << std::endl;
+	std::cout << "tile ms:    p50 " << percentile(times, 50) * 1e3 << ", p90 " << percentile(times, 90) * 1e3
+		<< ", p99 " << percentile(times, 99) * 1e3 << ", max " << (times.empty() ? 0.0 : times.back() * 1e3) << std::endl;
+	std::cout << "peak RSS:   " << peakRSSMegabytes() << " MB" << std::endl;
+	std::cout << "content:    " << stats.bytes / (1024.0 * 1024.0) << " MB read, " << stats.triangles << " triangles, "
+		<< stats.points << " points, " << stats.texels / 1e6 << " Mtexels" << std::endl;
+
+	// stage times are summed over all threads, so they are compared with the
+	// summed tile load times rather than the wall time
+	std::cout << "stages (summed over tiles):" << std::endl;
+	double stagesSeconds = 0.0;
+	for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i)
+	{
+		TileStats3MX::Stage stage = (TileStats3MX::Stage)i;
+		stagesSeconds += stats.seconds(stage);
+		std::cout << "  " << std::left << std::setw(20) << TileStats3MX::stageName(stage) << std::right
+			<< std::setw(10) << stats.seconds(stage) * 1e3 << " ms"
+			<< std::setw(8) << (loadSeconds > 0.0 ? stats.seconds(stage) / loadSeconds * 100.0 : 0.0) << " %"
+			<< std::setw(10) << (stats.tiles ? stats.seconds(stage) / stats.tiles * 1e3 : 0.0) << " ms/tile" << std::endl;
+	}
+	std::cout << "  " << std::left << std::setw(20) << "other" << std::right
+		<< std::setw(10) << std::max(0.0, loadSeconds - stagesSeconds) * 1e3 << " ms"
+		<< std::setw(8) << (loadSeconds > 0.0 ? std::max(0.0, loadSeconds - stagesSeconds) / loadSeconds * 100.0 : 0.0) << " %" << std::endl;
+
+	std::cout << "slowest tiles:" << std::endl;
+	for (auto& tile : slowestTiles.tiles)
+	{
+		std::cout << "  " << std::setw(8) << totalSeconds(tile) * 1e3 << " ms";
+		for (int i = 0; i < TileStats3MX::NUM_STAGES; ++i)
+		{
+			std::cout << (i ? ", " : " (") << TileStats3MX::stageName((TileStats3MX::Stage)i) << " " << tile.seconds[i] * 1e3;
+		}
+		std::cout << ") " << tile.fileName << std::endl;
+	}
+
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,408 @@
+// Converts the resources of a 3mx dataset to the formats that are fastest to
+// load: ctm meshes to the fast decoding fmc format (see MeshCodec3MX.h), and
+// jpg textures to BC1 compressed ktx textures with mipmaps (see Ktx3MX.h).
+// All other resources are copied as they are.
+//
+// usage: 3mxconv [-m] [-t] <input.3mx> <output.3mx>
+//
+//   -m  convert the ctm meshes, the default without options
+//   -t  convert the jpg textures
+//
+// Tiles are found by walking the layer roots and the node children of every
+// tile, and written under the directory of the output .3mx at the same
+// relative paths. The output could be the input, to convert in place.
+
+#include <osg/Image>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CJsonObject.hpp"
+#include "openctm.h"
+#include "Archive3MX.h"
+#include "MeshCodec3MX.h"
+#include "Ktx3MX.h"
+
+namespace
+{
+	bool readFile(const std::string& fileName, std::string& content)
+	{
+		std::ifstream inFile(fileName, std::ios::in | std::ios::binary);
+		if (!inFile) return false;
+		content.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	bool writeFile(const std::string& fileName, const std::string& content)
+	{
+		osgDB::makeDirectoryForFile(fileName);
+		std::ofstream outFile(fileName, std::ios::out | std::ios::binary);
+		outFile.write(content.data(), content.size());
+		return (bool)outFile;
+	}
+
+	// Decodes a ctm buffer and encodes it as fmc.
+	bool convertMesh(const char* data, size_t size, std::string& buffer)
+	{
+		try
+		{
+			CTMimporter ctm;
+			ctm.LoadFromMemory(data, (CTMuint)size);
+			if (ctm.GetInteger(CTM_READ_SIZE) != (CTMuint)size) return false;
+
+			CTMuint vertCount = ctm.GetInteger(CTM_VERTEX_COUNT);
+			const CTMfloat* normals = ctm.GetInteger(CTM_HAS_NORMALS) == CTM_TRUE ? ctm.GetFloatArray(CTM_NORMALS) : nullptr;
+			const CTMfloat* uvs = ctm.GetInteger(CTM_UV_MAP_COUNT) ? ctm.GetFloatArray(CTM_UV_MAP_1) : nullptr;
+			MeshCodec3MX::encode(ctm.GetFloatArray(CTM_VERTICES), normals, uvs, vertCount,
+				ctm.GetIntegerArray(CTM_INDICES), ctm.GetInteger(CTM_TRIANGLE_COUNT) * 3, buffer);
+		}
+		catch (const ctm_error& e)
+		{
+			std::cerr << "decoding ctm buffer failed! " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// 8-bit RGB pixels of an image, in its row order.
+	bool getRGB(const osg::Image* image, std::vector<unsigned char>& rgb)
+	{
+		unsigned int components = 0;
+		switch (image->getPixelFormat())
+		{
+		case GL_LUMINANCE: components = 1; break;
+		case GL_RGB: components = 3; break;
+		case GL_RGBA: components = 4; break;
+		}
+		if (!components || image->getDataType() != GL_UNSIGNED_BYTE || image->s() <= 0 || image->t() <= 0) return false;
+
+		rgb.resize((size_t)image->s() * image->t() * 3);
+		unsigned char* dst = &rgb[0];
+		for (int y = 0; y < image->t(); ++y)
+		{
+			const unsigned char* src = image->data(0, y);
+			for (int x = 0; x < image->s(); ++x, src += components, dst += 3)
+			{
+				dst[0] = src[0];
+				dst[1] = src[components > 1 ? 1 : 0];
+				dst[2] = src[components > 1 ? 2 : 0];
+			}
+		}
+		return true;
+	}
+
+	// Next mipmap level, a 2x2 box filter.
+	void downsample(const std::vector<unsigned char>& src, int width, int height, std::vector<unsigned char>& dst)
+	{
+		int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+		dst.resize((size_t)w * h * 3);
+		for (int y = 0; y < h; ++y)
+		{
+			int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+			for (int x = 0; x < w; ++x)
+			{
+				int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+				for (int c = 0; c < 3; ++c)
+				{
+					int sum = src[((size_t)y0 * width + x0) * 3 + c] + src[((size_t)y0 * width + x1) * 3 + c]
+						+ src[((size_t)y1 * width + x0) * 3 + c] + src[((size_t)y1 * width + x1) * 3 + c];
+					dst[((size_t)y * w + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	inline uint16_t toRGB565(const int c[3])
+	{
+		return (uint16_t)(((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 | ((c[2] * 31 + 127) / 255));
+	}
+
+	inline void fromRGB565(uint16_t v, int c[3])
+	{
+		c[0] = ((v >> 11) & 31) * 255 / 31;
+		c[1] = ((v >> 5) & 63) * 255 / 63;
+		c[2] = (v & 31) * 255 / 31;
+	}
+
+	// Compresses a 4x4 block to BC1: the endpoints are the corners of the color
+	// bounding box, inset a little, on the diagonal along which the colors
+	// correlate with green.
+	void compressBlockBC1(const unsigned char pixels[16][3], std::string& out)
+	{
+		int minColor[3] = { 255, 255, 255 }, maxColor[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				minColor[c] = std::min(minColor[c], (int)pixels[i][c]);
+				maxColor[c] = std::max(maxColor[c], (int)pixels[i][c]);
+				mean[c] += pixels[i][c];
+			}
+		}
+		int covariance[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; ++i)
+		{
+			int dg = pixels[i][1] * 16 - mean[1];
+			covariance[0] += (pixels[i][0] * 16 - mean[0]) * dg;
+			covariance[2] += (pixels[i][2] * 16 - mean[2]) * dg;
+		}
+		for (int c = 0; c < 3; ++c)
+		{
+			int inset = (maxColor[c] - minColor[c]) / 16;
+			minColor[c] += inset;
+			maxColor[c] -= inset;
+			if (covariance[c] < 0) std::swap(minColor[c], maxColor[c]);
+		}
+
+		uint16_t c0 = toRGB565(maxColor), c1 = toRGB565(minColor);
+		if (c0 < c1) std::swap(c0, c1);
+		uint32_t indices = 0;
+		if (c0 != c1)
+		{
+			int palette[4][3];
+			fromRGB565(c0, palette[0]);
+			fromRGB565(c1, palette[1]);
+			for (int c = 0; c < 3; ++c)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			for (int i = 0; i < 16; ++i)
+			{
+				int best = 0, bestDistance = INT_MAX;
+				for (int j = 0; j < 4; ++j)
+				{
+					int distance = 0;
+					for (int c = 0; c < 3; ++c) distance += (pixels[i][c] - palette[j][c]) * (pixels[i][c] - palette[j][c]);
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = j;
+					}
+				}
+				indices |= (uint32_t)best << (i * 2);
+			}
+		}
+		out.append((const char*)&c0, 2);
+		out.append((const char*)&c1, 2);
+		out.append((const char*)&indices, 4);
+	}
+
+	void compressBC1(const std::vector<unsigned char>& rgb, int width, int height, std::string& out)
+	{
+		unsigned char pixels[16][3];
+		for (int by = 0; by < height; by += 4)
+		{
+			for (int bx = 0; bx < width; bx += 4)
+			{
+				for (int i = 0; i < 16; ++i)
+				{
+					int x = std::min(bx + i % 4, width - 1), y = std::min(by + i / 4, height - 1);
+					memcpy(pixels[i], &rgb[((size_t)y * width + x) * 3], 3);
+				}
+				compressBlockBC1(pixels, out);
+			}
+		}
+	}
+
+	// Decodes a jpg texture and encodes it as a BC1 ktx with all its mipmaps.
+	bool convertTexture(const char* data, size_t size, std::string& buffer)
+	{
+		osgDB::ReaderWriter* reader = osgDB::Registry::instance()->getReaderWriterForExtension("jpg");
+		if (!reader)
+		{
+			std::cerr << "no jpg plugin" << std::endl;
+			return false;
+		}
+		std::istringstream stream(std::string(data, size));
+		osgDB::ReaderWriter::ReadResult rr = reader->readImage(stream);
+		std::vector<unsigned char> rgb, next;
+		if (!rr.validImage() || !getRGB(rr.getImage(), rgb))
+		{
+			std::cerr << "decoding jpg texture failed!" << std::endl;
+			return false;
+		}
+
+		int width = rr.getImage()->s(), height = rr.getImage()->t();
+		std::vector<std::string> levels;
+		for (int w = width, h = height; ; )
+		{
+			levels.push_back(std::string());
+			compressBC1(rgb, w, h, levels.back());
+			if (w == 1 && h == 1) break;
+			downsample(rgb, w, h, next);
+			rgb.swap(next);
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
+		}
+		Ktx3MX::write(0x83F0 /*GL_COMPRESSED_RGB_S3TC_DXT1_EXT*/, width, height, levels, buffer);
+		return true;
+	}
+
+	struct Conversions
+	{
+		bool meshes = false;
+		bool textures = false;
+		size_t meshCount = 0;
+		size_t textureCount = 0;
+	};
+
+	// Converts the .3mxb tile content in place, and returns its JSON header.
+	bool convertTile(std::string& content, neb::CJsonObject& oJson, Conversions& conversions)
+	{
+		uint32_t headerSize = 0;
+		if (content.size() < 9 || content.compare(0, 5, "3MXBO") != 0) return false;
+		memcpy(&headerSize, &content[5], 4);
+		if (content.size() - 9 < headerSize || !oJson.Parse(content.substr(9, headerSize))) return false;
+
+		std::string buffers;
+		size_t pos = 9 + headerSize;
+		for (int i = 0; i < oJson["resources"].GetArraySize(); ++i)
+		{
+			neb::CJsonObject& oJsonResource = oJson["resources"][i];
+			std::string type, format;
+			int bufferSize = 0;
+			oJsonResource.Get("type", type);
+			oJsonResource.Get("format", format);
+			if (!oJsonResource.Get("size", bufferSize)) continue;
+			if (bufferSize < 0 || (size_t)bufferSize > content.size() - pos) return false;
+
+			if (conversions.meshes && type == "geometryBuffer" && format == "ctm")
+			{
+				std::string buffer;
+				if (!convertMesh(content.data() + pos, bufferSize, buffer)) return false;
+				oJsonResource.Replace("format", std::string("fmc"));
+				oJsonResource.Replace("size", (int)buffer.size());
+				buffers.append(buffer);
+				++conversions.meshCount;
+			}
+			else if (conversions.textures && type == "textureBuffer" && format == "jpg" && bufferSize)
+			{
+				std::string buffer;
+				if (!convertTexture(content.data() + pos, bufferSize, buffer)) return false;
+				oJsonResource.Replace("format", std::string("ktx"));
+				oJsonResource.Replace("size", (int)buffer.size());
+				buffers.append(buffer);
+				++conversions.textureCount;
+			}
+			else
+			{
+				buffers.append(content, pos, bufferSize);
+			}
+			pos += bufferSize;
+		}
+
+		std::string header = oJson.ToString();
+		headerSize = (uint32_t)header.size();
+		content = "3MXBO";
+		content.append((const char*)&headerSize, 4);
+		content.append(header);
+		content.append(buffers);
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Conversions conversions;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-m") conversions.meshes = true;
+		else if (arg == "-t") conversions.textures = true;
+		else if (arg[0] != '-') paths.push_back(arg);
+		else paths.clear();
+	}
+	if (paths.size() != 2 || osgDB::getLowerCaseFileExtension(paths[0]) != "3mx" || osgDB::getLowerCaseFileExtension(paths[1]) != "3mx")
+	{
+		std::cerr << "usage: " << argv[0] << " [-m] [-t] <input.3mx> <output.3mx>" << std::endl;
+		return 1;
+	}
+	if (!conversions.textures) conversions.meshes = true;
+	std::string input = paths[0];
+	std::string output = paths[1];
+	std::string baseDir = osgDB::getFilePath(input);
+	std::string outputDir = osgDB::getFilePath(output);
+
+	std::string file_3mx;
+	neb::CJsonObject oJson_3mx;
+	if (!readFile(input, file_3mx) || !oJson_3mx.Parse(file_3mx))
+	{
+		std::cerr << "Reading file " << input << " failed!" << std::endl;
+		return 2;
+	}
+
+	// tile names relative to the .3mx
+	std::vector<std::string> tileNames;
+	std::set<std::string> knownNames;
+	for (int i = 0; i < oJson_3mx["layers"].GetArraySize(); ++i)
+	{
+		std::string root;
+		oJson_3mx["layers"][i].Get("root", root);
+		root = Archive3MX::normalizeEntryName(root);
+		if (!root.empty() && knownNames.insert(root).second) tileNames.push_back(root);
+	}
+
+	size_t bytesIn = 0, bytesOut = 0;
+	for (size_t i = 0; i < tileNames.size(); ++i)
+	{
+		std::string content;
+		neb::CJsonObject oJson;
+		std::string fileName = osgDB::concatPaths(baseDir, tileNames[i]);
+		if (!readFile(fileName, content))
+		{
+			std::cerr << "Reading tile " << fileName << " failed!" << std::endl;
+			return 2;
+		}
+		bytesIn += content.size();
+		if (!convertTile(content, oJson, conversions))
+		{
+			std::cerr << "Converting tile " << fileName << " failed!" << std::endl;
+			return 2;
+		}
+		bytesOut += content.size();
+
+		std::string outputName = osgDB::concatPaths(outputDir, tileNames[i]);
+		if (!writeFile(outputName, content))
+		{
+			std::cerr << "Writing tile " << outputName << " failed!" << std::endl;
+			return 2;
+		}
+
+		std::string tileDir = osgDB::getFilePath(tileNames[i]);
+		for (int j = 0; j < oJson["nodes"].GetArraySize(); ++j)
+		{
+			for (int k = 0; k < oJson["nodes"][j]["children"].GetArraySize(); ++k)
+			{
+				std::string child;
+				oJson["nodes"][j]["children"].Get(k, child);
+				child = Archive3MX::normalizeEntryName(tileDir + "/" + child);
+				if (knownNames.insert(child).second) tileNames.push_back(child);
+			}
+		}
+	}
+
+	if (!writeFile(output, file_3mx))
+	{
+		std::cerr << "Writing file " << output << " failed!" << std::endl;
+		return 2;
+	}
+
+	std::cout << "converted " << conversions.meshCount << " meshes and " << conversions.textureCount << " textures of " << tileNames.size() << " tiles, "
+		<< bytesIn << " -> " << bytesOut << " bytes" << std::endl;
+	return 0;
+}
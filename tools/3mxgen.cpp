@@ -0,0 +1,446 @@
+// Synthetic dataset generator for scaling tests of the 3mx plugin. Writes a
+// .3mx root and a quadtree-like LOD pyramid of .3mxb tiles under "Data/",
+// made of MG2 compressed height field meshes with jpg textures, or of xyz
+// point clouds. The terrain and textures are procedural and only depend on
+// the parameters, so the same dataset is generated on any machine.
+//
+// usage: 3mxgen [-d depth] [-f fanout] [-g grid] [-t texture] [-q quality]
+//               [-e extent] [-s seed] [-p] <output.3mx>
+//
+//   -d  levels of the pyramid, 3 by default
+//   -f  every tile has fanout x fanout children, 2 by default
+//   -g  quads per tile side (mesh density), 64 by default
+//   -t  texture size in texels per tile side, 256 by default
+//   -q  jpg quality, 90 by default
+//   -e  extent of the dataset, 1000 by default
+//   -s  seed of the terrain, 1 by default
+//   -p  write xyz point clouds of (grid + 1)^2 points instead of meshes
+
+#include <osg/BoundingBox>
+#include <osg/Image>
+#include <osg/Vec4ub>
+
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CJsonObject.hpp"
+#include "openctm.h"
+
+namespace
+{
+	struct Parameters
+	{
+		int depth = 3;
+		int fanout = 2;
+		int grid = 64;
+		int textureSize = 256;
+		int jpegQuality = 90;
+		double extent = 1000.0;
+		uint32_t seed = 1;
+		bool points = false;
+	};
+
+	CTMuint CTMCALL ctmStringWrite(const void* buf, CTMuint count, void* userData)
+	{
+		((std::string*)userData)->append((const char*)buf, count);
+		return count;
+	}
+
+	void addToJsonArray(neb::CJsonObject& oJson, const std::string& key, const osg::Vec3& v)
+	{
+		oJson.AddEmptySubArray(key);
+		for (int j = 0; j < 3; ++j)
+		{
+			oJson[key].Add(v[j]);
+		}
+	}
+
+	// Integer hash of a lattice point, the same on every platform (unlike rand()).
+	uint32_t hash(int32_t x, int32_t y, uint32_t seed)
+	{
+		uint32_t h = seed * 0x9E3779B9u ^ (uint32_t)x * 0x85EBCA6Bu ^ (uint32_t)y * 0xC2B2AE35u;
+		h ^= h >> 16;
+		h *= 0x7FEB352Du;
+		h ^= h >> 15;
+		h *= 0x846CA68Bu;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// Smoothly interpolated lattice noise in [0, 1].
+	double valueNoise(double x, double y, uint32_t seed)
+	{
+		double fx = std::floor(x), fy = std::floor(y);
+		int32_t ix = (int32_t)fx, iy = (int32_t)fy;
+		double tx = x - fx, ty = y - fy;
+		tx = tx * tx * (3.0 - 2.0 * tx);
+		ty = ty * ty * (3.0 - 2.0 * ty);
+		const double scale = 1.0 / 4294967295.0;
+		double v00 = hash(ix, iy, seed) * scale, v10 = hash(ix + 1, iy, seed) * scale;
+		double v01 = hash(ix, iy + 1, seed) * scale, v11 = hash(ix + 1, iy + 1, seed) * scale;
+		return (v00 * (1.0 - tx) + v10 * tx) * (1.0 - ty) + (v01 * (1.0 - tx) + v11 * tx) * ty;
+	}
+
+	// Procedural terrain, defined over the whole dataset so that every level
+	// samples the same surface.
+	class Terrain
+	{
+	public:
+		Terrain(const Parameters& parameters) : _extent(parameters.extent), _seed(parameters.seed) {}
+
+		double height(double x, double y) const
+		{
+			double h = 0.0, cell = _extent / 4.0, amplitude = _extent * 0.05;
+			for (uint32_t octave = 0; octave < 8; ++octave)
+			{
+				h += (valueNoise(x / cell, y / cell, _seed + octave) - 0.5) * amplitude;
+				cell *= 0.5;
+				amplitude *= 0.45;
+			}
+			return h;
+		}
+
+		osg::Vec4ub color(double x, double y) const
+		{
+			// height ramp from green to brown to white, with some fine grain
+			double t = std::min(1.0, std::max(0.0, height(x, y) / (_extent * 0.08) + 0.5));
+			double grain = 0.85 + 0.3 * valueNoise(x / (_extent / 2048.0), y / (_extent / 2048.0), _seed + 100);
+			double r, g, b;
+			if (t < 0.5) { r = 0.25 + 0.6 * t; g = 0.45 + 0.1 * t; b = 0.2; }
+			else if (t < 0.8) { r = 0.55 - 0.3 * (t - 0.5); g = 0.5 - 0.5 * (t - 0.5); b = 0.2 + 0.2 * (t - 0.5); }
+			else { r = g = b = 0.5 + 2.0 * (t - 0.8); }
+			return osg::Vec4ub((unsigned char)std::min(255.0, r * grain * 255.0), (unsigned char)std::min(255.0, g * grain * 255.0),
+				(unsigned char)std::min(255.0, b * grain * 255.0), 255);
+		}
+
+	private:
+		double _extent;
+		uint32_t _seed;
+	};
+
+	class Generator
+	{
+	public:
+		Generator(const Parameters& parameters) :
+			_parameters(parameters),
+			_terrain(parameters),
+			_tiles(0),
+			_bytes(0)
+		{
+			_jpegOptions = new osgDB::ReaderWriter::Options("JPEG_QUALITY " + std::to_string(parameters.jpegQuality));
+			_jpegWriter = osgDB::Registry::instance()->getReaderWriterForExtension("jpg");
+		}
+
+		bool write(const std::string& fileName)
+		{
+			if (!_parameters.points && !_jpegWriter)
+			{
+				std::cerr << "No jpg writer plugin found." << std::endl;
+				return false;
+			}
+
+			std::string stem = osgDB::getNameLessExtension(osgDB::getSimpleFileName(fileName));
+			_outputDir = osgDB::concatPaths(osgDB::getFilePath(fileName), "Data");
+			if (!osgDB::makeDirectory(_outputDir))
+			{
+				std::cerr << "Can NOT create directory " << _outputDir << std::endl;
+				return false;
+			}
+
+			neb::CJsonObject oJson_3mx;
+			oJson_3mx.Add("3mxVersion", 1);
+			oJson_3mx.Add("name", stem);
+			oJson_3mx.Add("description", std::string("synthetic dataset"));
+			oJson_3mx.Add("logo", std::string(""));
+			oJson_3mx.AddEmptySubArray("sceneOptions");
+			oJson_3mx.AddEmptySubArray("layers");
+
+			neb::CJsonObject oJsonLayer;
+			oJsonLayer.Add("type", std::string("meshPyramid"));
+			oJsonLayer.Add("id", std::string("mesh0"));
+			oJsonLayer.Add("name", stem);
+			oJsonLayer.Add("description", std::string(""));
+			oJsonLayer.Add("SRS", std::string(""));
+			oJsonLayer.Add("root", "Data/" + tileName(0, 0, 0));
+			oJson_3mx["layers"].Add(oJsonLayer);
+
+			std::ofstream outFile_3mx(fileName, std::ios::out | std::ios::binary);
+			outFile_3mx << oJson_3mx.ToFormattedString();
+			if (!outFile_3mx)
+			{
+				std::cerr << "Writing file " << fileName << " failed!" << std::endl;
+				return false;
+			}
+
+			return writeTile(0, 0, 0);
+		}
+
+		unsigned int tiles() const { return _tiles; }
+		uint64_t bytes() const { return _bytes; }
+
+	private:
+		std::string tileName(int level, int x, int y) const
+		{
+			return "L" + std::to_string(level) + "_" + std::to_string(x) + "_" + std::to_string(y) + ".3mxb";
+		}
+
+		// Writes the tile (x, y) of a level and its children, depth first.
+		bool writeTile(int level, int x, int y)
+		{
+			int tilesPerSide = 1;
+			for (int i = 0; i < level; ++i) tilesPerSide *= _parameters.fanout;
+			double size = _parameters.extent / tilesPerSide;
+			double x0 = -_parameters.extent * 0.5 + x * size;
+			double y0 = -_parameters.extent * 0.5 + y * size;
+			bool leaf = level + 1 >= _parameters.depth;
+
+			neb::CJsonObject oJson;
+			oJson.Add("version", 1);
+			oJson.AddEmptySubArray("nodes");
+			oJson.AddEmptySubArray("resources");
+
+			neb::CJsonObject oJsonNode;
+			oJsonNode.Add("id", std::string("node0"));
+			oJsonNode.AddEmptySubArray("children");
+			if (!leaf)
+			{
+				for (int j = 0; j < _parameters.fanout; ++j)
+				{
+					for (int i = 0; i < _parameters.fanout; ++i)
+					{
+						oJsonNode["children"].Add(tileName(level + 1, x * _parameters.fanout + i, y * _parameters.fanout + j));
+					}
+				}
+			}
+			oJsonNode.AddEmptySubArray("resources");
+
+			std::vector<std::string> buffers;
+			osg::BoundingBox bb;
+			std::string geometryBuffer = _parameters.points ? encodePoints(x0, y0, size, hash(x, y, _parameters.seed + level), bb) : encodeMesh(x0, y0, size, bb);
+			if (geometryBuffer.empty()) return false;
+
+			neb::CJsonObject oJsonResource;
+			oJsonResource.Add("type", std::string("geometryBuffer"));
+			oJsonResource.Add("id", std::string("geometry0"));
+			oJsonResource.Add("format", std::string(_parameters.points ? "xyz" : "ctm"));
+			oJsonResource.Add("size", (int)geometryBuffer.size());
+			addToJsonArray(oJsonResource, "bbMin", bb._min);
+			addToJsonArray(oJsonResource, "bbMax", bb._max);
+
+			if (!_parameters.points)
+			{
+				std::string textureBuffer = encodeTexture(x0, y0, size);
+				if (textureBuffer.empty()) return false;
+
+				neb::CJsonObject oJsonTexture;
+				oJsonTexture.Add("type", std::string("textureBuffer"));
+				oJsonTexture.Add("format", std::string("jpg"));
+				oJsonTexture.Add("id", std::string("texture0"));
+				oJsonTexture.Add("size", (int)textureBuffer.size());
+				oJson["resources"].Add(oJsonTexture);
+				buffers.push_back(textureBuffer);
+				oJsonResource.Add("texture", std::string("texture0"));
+			}
+			oJson["resources"].Add(oJsonResource);
+			oJsonNode["resources"].Add(std::string("geometry0"));
+			buffers.push_back(geometryBuffer);
+
+			addToJsonArray(oJsonNode, "bbMin", bb._min);
+			addToJsonArray(oJsonNode, "bbMax", bb._max);
+			// switch to the children when a texel covers about a pixel
+			oJsonNode.Add("maxScreenDiameter", leaf ? 0.f : (float)_parameters.textureSize);
+			oJson["nodes"].Add(oJsonNode);
+
+			std::string header = oJson.ToString();
+			uint32_t headerSize = (uint32_t)header.size();
+			std::string buffer = "3MXBO";
+			buffer.append((const char*)&headerSize, 4);
+			buffer.append(header);
+			for (auto& resourceBuffer : buffers)
+			{
+				buffer.append(resourceBuffer);
+			}
+
+			std::string path = osgDB::concatPaths(_outputDir, tileName(level, x, y));
+			std::ofstream outFile(path, std::ios::out | std::ios::binary);
+			outFile.write(buffer.data(), buffer.size());
+			if (!outFile)
+			{
+				std::cerr << "Writing file " << path << " failed!" << std::endl;
+				return false;
+			}
+			++_tiles;
+			_bytes += buffer.size();
+
+			if (!leaf)
+			{
+				for (int j = 0; j < _parameters.fanout; ++j)
+				{
+					for (int i = 0; i < _parameters.fanout; ++i)
+					{
+						if (!writeTile(level + 1, x * _parameters.fanout + i, y * _parameters.fanout + j)) return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		std::string encodeMesh(double x0, double y0, double size, osg::BoundingBox& bb)
+		{
+			int n = _parameters.grid + 1;
+			std::vector<CTMfloat> vertices(n * n * 3);
+			std::vector<CTMfloat> uvs(n * n * 2);
+			for (int j = 0; j < n; ++j)
+			{
+				for (int i = 0; i < n; ++i)
+				{
+					double u = (double)i / _parameters.grid, v = (double)j / _parameters.grid;
+					double px = x0 + u * size, py = y0 + v * size;
+					osg::Vec3 p(px, py, _terrain.height(px, py));
+					memcpy(&vertices[(j * n + i) * 3], p.ptr(), sizeof(float) * 3);
+					uvs[(j * n + i) * 2] = (CTMfloat)u;
+					uvs[(j * n + i) * 2 + 1] = (CTMfloat)v;
+					bb.expandBy(p);
+				}
+			}
+
+			std::vector<CTMuint> indices;
+			indices.reserve(_parameters.grid * _parameters.grid * 6);
+			for (int j = 0; j < _parameters.grid; ++j)
+			{
+				for (int i = 0; i < _parameters.grid; ++i)
+				{
+					CTMuint v0 = j * n + i, v1 = v0 + 1, v2 = v0 + n, v3 = v2 + 1;
+					CTMuint quad[6] = { v0, v1, v3, v0, v3, v2 };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+			}
+
+			std::string buffer;
+			try
+			{
+				CTMexporter ctm;
+				ctm.DefineMesh(&vertices[0], (CTMuint)(n * n), &indices[0], (CTMuint)(indices.size() / 3), nullptr);
+				ctm.AddUVMap(&uvs[0], "Diffuse color", nullptr);
+				ctm.CompressionMethod(CTM_METHOD_MG2);
+				ctm.VertexPrecisionRel(0.01f);
+				ctm.SaveCustom(ctmStringWrite, &buffer);
+			}
+			catch (const ctm_error& e)
+			{
+				std::cerr << "Encoding ctm buffer failed! " << e.what() << std::endl;
+				buffer.clear();
+			}
+			return buffer;
+		}
+
+		std::string encodePoints(double x0, double y0, double size, uint32_t tileSeed, osg::BoundingBox& bb)
+		{
+			int n = _parameters.grid + 1;
+			std::vector<float> positions(n * n * 3);
+			std::vector<osg::Vec4ub> colors(n * n);
+			for (int j = 0; j < n; ++j)
+			{
+				for (int i = 0; i < n; ++i)
+				{
+					// jittered inside the grid cell, so the points do not line up
+					uint32_t h = hash(i, j, tileSeed);
+					double px = x0 + (i + (h & 0xFFFF) / 65536.0) / n * size;
+					double py = y0 + (j + (h >> 16) / 65536.0) / n * size;
+					osg::Vec3 p(px, py, _terrain.height(px, py));
+					memcpy(&positions[(j * n + i) * 3], p.ptr(), sizeof(float) * 3);
+					colors[j * n + i] = _terrain.color(px, py);
+					bb.expandBy(p);
+				}
+			}
+
+			std::string buffer;
+			uint32_t count = (uint32_t)(n * n);
+			buffer.append((const char*)&count, 4);
+			buffer.append((const char*)&positions[0], positions.size() * sizeof(float));
+			buffer.append((const char*)&colors[0], colors.size() * sizeof(osg::Vec4ub));
+			return buffer;
+		}
+
+		std::string encodeTexture(double x0, double y0, double size)
+		{
+			int s = _parameters.textureSize;
+			osg::ref_ptr<osg::Image> image = new osg::Image;
+			image->allocateImage(s, s, 1, GL_RGB, GL_UNSIGNED_BYTE);
+			for (int j = 0; j < s; ++j)
+			{
+				unsigned char* row = image->data(0, j);
+				for (int i = 0; i < s; ++i)
+				{
+					osg::Vec4ub c = _terrain.color(x0 + (i + 0.5) / s * size, y0 + (j + 0.5) / s * size);
+					row[i * 3] = c.r();
+					row[i * 3 + 1] = c.g();
+					row[i * 3 + 2] = c.b();
+				}
+			}
+
+			std::ostringstream textureStream;
+			if (!_jpegWriter->writeImage(*image, textureStream, _jpegOptions.get()).success())
+			{
+				std::cerr << "Encoding jpg texture failed." << std::endl;
+				return std::string();
+			}
+			return textureStream.str();
+		}
+
+		Parameters _parameters;
+		Terrain _terrain;
+		std::string _outputDir;
+		osg::ref_ptr<osgDB::ReaderWriter::Options> _jpegOptions;
+		osgDB::ReaderWriter* _jpegWriter;
+		unsigned int _tiles;
+		uint64_t _bytes;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	Parameters parameters;
+	std::string path;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "-d" && i + 1 < argc) parameters.depth = std::max(1, atoi(argv[++i]));
+		else if (arg == "-f" && i + 1 < argc) parameters.fanout = std::max(1, atoi(argv[++i]));
+		else if (arg == "-g" && i + 1 < argc) parameters.grid = std::max(1, atoi(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc) parameters.textureSize = std::max(1, atoi(argv[++i]));
+		else if (arg == "-q" && i + 1 < argc) parameters.jpegQuality = std::min(100, std::max(1, atoi(argv[++i])));
+		else if (arg == "-e" && i + 1 < argc) parameters.extent = std::max(1e-3, atof(argv[++i]));
+		else if (arg == "-s" && i + 1 < argc) parameters.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-p") parameters.points = true;
+		else if (path.empty() && arg[0] != '-') path = arg;
+		else
+		{
+			path.clear();
+			break;
+		}
+	}
+	if (path.empty() || osgDB::getLowerCaseFileExtension(path) != "3mx")
+	{
+		std::cerr << "usage: " << argv[0] << " [-d depth] [-f fanout] [-g grid] [-t texture] [-q quality] [-e extent] [-s seed] [-p] <output.3mx>" << std::endl;
+		return 1;
+	}
+
+	Generator generator(parameters);
+	if (!generator.write(path)) return 2;
+
+	std::cout << "wrote " << generator.tiles() << " tiles, " << generator.bytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+	return 0;
+}
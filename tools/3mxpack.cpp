@@ -0,0 +1,106 @@
+// Packs a 3mx dataset into a single .3mxa archive, which the 3mx plugin reads
+// like the original .3mx, without a file system lookup per tile.
+//
+// usage: 3mxpack <input.3mx> <output.3mxa>
+//
+// Tiles are found by walking the layer roots and the node children of every
+// tile, and stored breadth first: the tiles of a level, and the children of
+// a node, are adjacent in the archive, in the order the pager requests them.
+
+#include <osgDB/FileNameUtils>
+
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CJsonObject.hpp"
+#include "Archive3MX.h"
+
+namespace
+{
+	bool readFile(const std::string& fileName, std::string& content)
+	{
+		std::ifstream inFile(fileName, std::ios::in | std::ios::binary);
+		if (!inFile) return false;
+		content.assign(std::istreambuf_iterator<char>(inFile), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	// Reads the JSON header of a .3mxb tile.
+	bool readTileHeader(const std::string& fileName, neb::CJsonObject& oJson)
+	{
+		std::ifstream inFile(fileName, std::ios::in | std::ios::binary);
+		char magicNumber[5];
+		uint32_t headerSize = 0;
+		inFile.read(magicNumber, 5);
+		inFile.read((char*)&headerSize, 4);
+		if (!inFile || std::string(magicNumber, 5) != "3MXBO") return false;
+
+		std::string header(headerSize, '\0');
+		inFile.read(&header[0], headerSize);
+		return inFile.gcount() == headerSize && oJson.Parse(header);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3 || osgDB::getLowerCaseFileExtension(argv[1]) != "3mx" || osgDB::getLowerCaseFileExtension(argv[2]) != "3mxa")
+	{
+		std::cerr << "usage: " << argv[0] << " <input.3mx> <output.3mxa>" << std::endl;
+		return 1;
+	}
+	std::string input = argv[1];
+	std::string baseDir = osgDB::getFilePath(input);
+
+	std::string file_3mx;
+	neb::CJsonObject oJson_3mx;
+	if (!readFile(input, file_3mx) || !oJson_3mx.Parse(file_3mx))
+	{
+		std::cerr << "Reading file " << input << " failed!" << std::endl;
+		return 2;
+	}
+
+	// entry names relative to the .3mx, the .3mx first
+	std::vector<std::string> entryNames;
+	std::set<std::string> knownNames;
+	entryNames.push_back(osgDB::getSimpleFileName(input));
+	for (int i = 0; i < oJson_3mx["layers"].GetArraySize(); ++i)
+	{
+		std::string root;
+		oJson_3mx["layers"][i].Get("root", root);
+		root = Archive3MX::normalizeEntryName(root);
+		if (!root.empty() && knownNames.insert(root).second) entryNames.push_back(root);
+	}
+
+	// breadth first walk of the tiles
+	for (size_t i = 1; i < entryNames.size(); ++i)
+	{
+		neb::CJsonObject oJson;
+		if (!readTileHeader(osgDB::concatPaths(baseDir, entryNames[i]), oJson))
+		{
+			std::cerr << "Reading tile " << osgDB::concatPaths(baseDir, entryNames[i]) << " failed!" << std::endl;
+			return 2;
+		}
+
+		std::string tileDir = osgDB::getFilePath(entryNames[i]);
+		for (int j = 0; j < oJson["nodes"].GetArraySize(); ++j)
+		{
+			for (int k = 0; k < oJson["nodes"][j]["children"].GetArraySize(); ++k)
+			{
+				std::string child;
+				oJson["nodes"][j]["children"].Get(k, child);
+				child = Archive3MX::normalizeEntryName(tileDir + "/" + child);
+				if (knownNames.insert(child).second) entryNames.push_back(child);
+			}
+		}
+	}
+
+	if (!Archive3MX::write(argv[2], baseDir, entryNames)) return 2;
+
+	std::cout << "packed " << entryNames.size() - 1 << " tiles into " << argv[2] << std::endl;
+	return 0;
+}